@@ -0,0 +1,369 @@
+/*
+ * Python binding for libsceadan.
+ *
+ * Buffers are taken with the buffer protocol (bytes, bytearray,
+ * memoryview, mmap, numpy arrays) and are not copied. The GIL is
+ * released while sceadan works, so several Python threads can classify
+ * with one Sceadan object at the same time.
+ *
+ * Feature rows are written into a writable buffer of C doubles, such
+ * as numpy.empty((n, s.nr_features)), or into a new buffer that is
+ * returned as a 2-D memoryview (numpy.asarray() wraps it without a copy).
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "sceadan.h"
+
+typedef struct {
+    PyObject_HEAD
+    sceadan *s;
+} SceadanObject;
+
+/* methods need an open handle; __init__ may have failed or not run */
+#define CHECK_OPEN(self) \
+    if((self)->s==NULL){ PyErr_SetString(PyExc_ValueError,"sceadan is not open"); return NULL; }
+
+static void Sceadan_dealloc(SceadanObject *self)
+{
+    if(self->s) sceadan_close(self->s);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static int Sceadan_init(SceadanObject *self,PyObject *args,PyObject *kwds)
+{
+    static char *kwlist[] = {"model","classes","mask","ngram_mode",NULL};
+    const char *model = NULL, *classes = NULL, *mask = NULL;
+    int ngram_mode = -1;
+    if(!PyArg_ParseTupleAndKeywords(args,kwds,"|zzzi",kwlist,&model,&classes,&mask,&ngram_mode)) return -1;
+    if(self->s) sceadan_close(self->s);
+    Py_BEGIN_ALLOW_THREADS
+    self->s = sceadan_open(model,classes,mask);
+    if(self->s && ngram_mode>=0) sceadan_set_ngram_mode(self->s,ngram_mode);
+    Py_END_ALLOW_THREADS
+    if(self->s==NULL){
+        PyErr_Format(PyExc_OSError,"cannot open sceadan model %s",model ? model : "<precompiled>");
+        return -1;
+    }
+    return 0;
+}
+
+/* The buffers of a sequence, held until release_buffers() */
+static Py_buffer *get_buffers(PyObject *seq,Py_ssize_t *count)
+{
+    PyObject *fast = PySequence_Fast(seq,"expected a sequence of buffers");
+    if(fast==NULL) return NULL;
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(fast);
+    Py_buffer *views = PyMem_Calloc(n ? n : 1,sizeof(Py_buffer));
+    if(views==NULL){
+        Py_DECREF(fast);
+        PyErr_NoMemory();
+        return NULL;
+    }
+    for(Py_ssize_t i=0;i<n;i++){
+        if(PyObject_GetBuffer(PySequence_Fast_GET_ITEM(fast,i),&views[i],PyBUF_SIMPLE)<0){
+            while(i-->0) PyBuffer_Release(&views[i]);
+            PyMem_Free(views);
+            Py_DECREF(fast);
+            return NULL;
+        }
+    }
+    Py_DECREF(fast);
+    *count = n;
+    return views;
+}
+
+static void release_buffers(Py_buffer *views,Py_ssize_t n)
+{
+    for(Py_ssize_t i=0;i<n;i++) PyBuffer_Release(&views[i]);
+    PyMem_Free(views);
+}
+
+static PyObject *int_list(const int *values,Py_ssize_t n)
+{
+    PyObject *list = PyList_New(n);
+    if(list==NULL) return NULL;
+    for(Py_ssize_t i=0;i<n;i++){
+        PyObject *v = PyLong_FromLong(values[i]);
+        if(v==NULL){
+            Py_DECREF(list);
+            return NULL;
+        }
+        PyList_SET_ITEM(list,i,v);
+    }
+    return list;
+}
+
+static PyObject *Sceadan_classify(SceadanObject *self,PyObject *args)
+{
+    CHECK_OPEN(self);
+    Py_buffer view;
+    if(!PyArg_ParseTuple(args,"y*",&view)) return NULL;
+    int type;
+    Py_BEGIN_ALLOW_THREADS
+    type = sceadan_classify_buf(self->s,(const uint8_t *)view.buf,view.len);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&view);
+    return PyLong_FromLong(type);
+}
+
+static PyObject *Sceadan_classify_many(SceadanObject *self,PyObject *args)
+{
+    CHECK_OPEN(self);
+    PyObject *seq;
+    if(!PyArg_ParseTuple(args,"O",&seq)) return NULL;
+    Py_ssize_t n = 0;
+    Py_buffer *views = get_buffers(seq,&n);
+    if(views==NULL) return NULL;
+    int *types = PyMem_Calloc(n ? n : 1,sizeof(int));
+    if(types==NULL){
+        release_buffers(views,n);
+        return PyErr_NoMemory();
+    }
+    Py_BEGIN_ALLOW_THREADS
+    for(Py_ssize_t i=0;i<n;i++){
+        types[i] = sceadan_classify_buf(self->s,(const uint8_t *)views[i].buf,views[i].len);
+    }
+    Py_END_ALLOW_THREADS
+    release_buffers(views,n);
+    PyObject *ret = int_list(types,n);
+    PyMem_Free(types);
+    return ret;
+}
+
+/* blocks of len bytes in a buffer of size bytes; the last may be short */
+static Py_ssize_t nr_blocks(Py_ssize_t size,Py_ssize_t len)
+{
+    return (size + len - 1) / len;
+}
+
+static PyObject *Sceadan_classify_blocks(SceadanObject *self,PyObject *args)
+{
+    CHECK_OPEN(self);
+    Py_buffer view;
+    Py_ssize_t block_size;
+    if(!PyArg_ParseTuple(args,"y*n",&view,&block_size)) return NULL;
+    if(block_size<=0){
+        PyBuffer_Release(&view);
+        PyErr_SetString(PyExc_ValueError,"block_size must be positive");
+        return NULL;
+    }
+    Py_ssize_t n = nr_blocks(view.len,block_size);
+    int *types = PyMem_Calloc(n ? n : 1,sizeof(int));
+    if(types==NULL){
+        PyBuffer_Release(&view);
+        return PyErr_NoMemory();
+    }
+    Py_BEGIN_ALLOW_THREADS
+    for(Py_ssize_t i=0;i<n;i++){
+        Py_ssize_t off = i*block_size;
+        Py_ssize_t len = (view.len-off < block_size) ? view.len-off : block_size;
+        types[i] = sceadan_classify_buf(self->s,(const uint8_t *)view.buf+off,len);
+    }
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&view);
+    PyObject *ret = int_list(types,n);
+    PyMem_Free(types);
+    return ret;
+}
+
+/* A new zeroed buffer of rows*cols doubles, as a 2-D memoryview */
+static PyObject *new_rows(Py_ssize_t rows,Py_ssize_t cols)
+{
+    PyObject *bytes = PyByteArray_FromStringAndSize(NULL,rows*cols*(Py_ssize_t)sizeof(double));
+    if(bytes==NULL) return NULL;
+    PyObject *mv = PyMemoryView_FromObject(bytes);
+    Py_DECREF(bytes);
+    if(mv==NULL) return NULL;
+    PyObject *ret = (rows && cols) ? PyObject_CallMethod(mv,"cast","s(nn)","d",rows,cols)
+                                   : PyObject_CallMethod(mv,"cast","s","d"); /* no zeros in a shape */
+    Py_DECREF(mv);
+    return ret;
+}
+
+/* Extract features of the given pieces into out, or into a new buffer */
+static PyObject *extract_rows(SceadanObject *self,Py_buffer *views,Py_ssize_t nviews,
+                              Py_ssize_t block_size,PyObject *out)
+{
+    const int cols = sceadan_nr_features(self->s);
+    Py_ssize_t rows = 0;
+    for(Py_ssize_t i=0;i<nviews;i++){
+        rows += block_size ? nr_blocks(views[i].len,block_size) : 1;
+    }
+    PyObject *ret = out;
+    if(ret) Py_INCREF(ret);
+    else    ret = new_rows(rows,cols);
+    if(ret==NULL) return NULL;
+
+    Py_buffer dst;
+    if(PyObject_GetBuffer(ret,&dst,PyBUF_WRITABLE|PyBUF_C_CONTIGUOUS|PyBUF_FORMAT)<0){
+        Py_DECREF(ret);
+        return NULL;
+    }
+    if(dst.format==NULL || strcmp(dst.format,"d")!=0){
+        PyErr_SetString(PyExc_ValueError,"out must hold float64 (format 'd')");
+        PyBuffer_Release(&dst);
+        Py_DECREF(ret);
+        return NULL;
+    }
+    if(dst.len < rows*cols*(Py_ssize_t)sizeof(double)){
+        PyErr_Format(PyExc_ValueError,"out holds %zd bytes; %zd rows of %d doubles are needed",
+                     dst.len,rows,cols);
+        PyBuffer_Release(&dst);
+        Py_DECREF(ret);
+        return NULL;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    double *row = (double *)dst.buf;
+    for(Py_ssize_t i=0;i<nviews;i++){
+        const uint8_t *buf = (const uint8_t *)views[i].buf;
+        Py_ssize_t len = views[i].len;
+        Py_ssize_t step = block_size ? block_size : len;
+        Py_ssize_t off = 0;
+        if(block_size && len==0) continue;  /* no blocks */
+        do {
+            Py_ssize_t piece = (len-off < step) ? len-off : step;
+            sceadan_extract_features(self->s,buf+off,piece,row,cols);
+            row += cols;
+            off += piece;
+        } while(off<len);
+    }
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&dst);
+    return ret;
+}
+
+static PyObject *Sceadan_extract(SceadanObject *self,PyObject *args,PyObject *kwds)
+{
+    CHECK_OPEN(self);
+    static char *kwlist[] = {"data","block_size","out",NULL};
+    Py_buffer view;
+    Py_ssize_t block_size = 0;
+    PyObject *out = NULL;
+    if(!PyArg_ParseTupleAndKeywords(args,kwds,"y*|nO",kwlist,&view,&block_size,&out)) return NULL;
+    if(block_size<0){
+        PyBuffer_Release(&view);
+        PyErr_SetString(PyExc_ValueError,"block_size must not be negative");
+        return NULL;
+    }
+    if(out==Py_None) out = NULL;
+    PyObject *ret = extract_rows(self,&view,1,block_size,out);
+    PyBuffer_Release(&view);
+    return ret;
+}
+
+static PyObject *Sceadan_extract_many(SceadanObject *self,PyObject *args,PyObject *kwds)
+{
+    CHECK_OPEN(self);
+    static char *kwlist[] = {"buffers","out",NULL};
+    PyObject *seq;
+    PyObject *out = NULL;
+    if(!PyArg_ParseTupleAndKeywords(args,kwds,"O|O",kwlist,&seq,&out)) return NULL;
+    if(out==Py_None) out = NULL;
+    Py_ssize_t n = 0;
+    Py_buffer *views = get_buffers(seq,&n);
+    if(views==NULL) return NULL;
+    PyObject *ret = extract_rows(self,views,n,0,out);
+    release_buffers(views,n);
+    return ret;
+}
+
+static PyObject *Sceadan_feature_indexes(SceadanObject *self,PyObject *unused)
+{
+    CHECK_OPEN(self);
+    int n = sceadan_nr_features(self->s);
+    int *indexes = PyMem_Calloc(n ? n : 1,sizeof(int));
+    if(indexes==NULL) return PyErr_NoMemory();
+    n = sceadan_feature_indexes(self->s,indexes,n);
+    PyObject *ret = int_list(indexes,n);
+    PyMem_Free(indexes);
+    return ret;
+}
+
+static PyObject *Sceadan_name_for_type(SceadanObject *self,PyObject *args)
+{
+    CHECK_OPEN(self);
+    int type;
+    if(!PyArg_ParseTuple(args,"i",&type)) return NULL;
+    const char *name = sceadan_name_for_type(self->s,type);
+    if(name==NULL) Py_RETURN_NONE;
+    return PyUnicode_FromString(name);
+}
+
+static PyObject *Sceadan_type_for_name(SceadanObject *self,PyObject *args)
+{
+    CHECK_OPEN(self);
+    const char *name;
+    if(!PyArg_ParseTuple(args,"s",&name)) return NULL;
+    return PyLong_FromLong(sceadan_type_for_name(self->s,name));
+}
+
+static PyObject *Sceadan_get_nr_features(SceadanObject *self,void *closure)
+{
+    CHECK_OPEN(self);
+    return PyLong_FromLong(sceadan_nr_features(self->s));
+}
+
+static PyMethodDef Sceadan_methods[] = {
+    {"classify",(PyCFunction)Sceadan_classify,METH_VARARGS,
+     "classify(data) -> type\nClassify a buffer as one item."},
+    {"classify_many",(PyCFunction)Sceadan_classify_many,METH_VARARGS,
+     "classify_many(buffers) -> [type, ...]\nClassify each buffer of a sequence."},
+    {"classify_blocks",(PyCFunction)Sceadan_classify_blocks,METH_VARARGS,
+     "classify_blocks(data, block_size) -> [type, ...]\n"
+     "Classify each block of a buffer, including a final partial block."},
+    {"extract",(PyCFunction)(void(*)(void))Sceadan_extract,METH_VARARGS|METH_KEYWORDS,
+     "extract(data, block_size=0, out=None) -> rows\n"
+     "Feature rows for the buffer, or for each of its blocks, as float64 with\n"
+     "nr_features columns. Written into out if given."},
+    {"extract_many",(PyCFunction)(void(*)(void))Sceadan_extract_many,METH_VARARGS|METH_KEYWORDS,
+     "extract_many(buffers, out=None) -> rows\nOne feature row per buffer."},
+    {"feature_indexes",(PyCFunction)Sceadan_feature_indexes,METH_NOARGS,
+     "feature_indexes() -> [index, ...]\nThe liblinear feature index of each column."},
+    {"name_for_type",(PyCFunction)Sceadan_name_for_type,METH_VARARGS,
+     "name_for_type(type) -> name or None"},
+    {"type_for_name",(PyCFunction)Sceadan_type_for_name,METH_VARARGS,
+     "type_for_name(name) -> type, or -1"},
+    {NULL}
+};
+
+static PyGetSetDef Sceadan_getset[] = {
+    {"nr_features",(getter)Sceadan_get_nr_features,NULL,"columns of a feature row",NULL},
+    {NULL}
+};
+
+static PyTypeObject SceadanType = {
+    PyVarObject_HEAD_INIT(NULL,0)
+    .tp_name      = "sceadan.Sceadan",
+    .tp_doc       = "Sceadan(model=None, classes=None, mask=None, ngram_mode=-1)\n"
+                    "A sceadan model; model None is the precompiled model.",
+    .tp_basicsize = sizeof(SceadanObject),
+    .tp_flags     = Py_TPFLAGS_DEFAULT,
+    .tp_new       = PyType_GenericNew,
+    .tp_init      = (initproc)Sceadan_init,
+    .tp_dealloc   = (destructor)Sceadan_dealloc,
+    .tp_methods   = Sceadan_methods,
+    .tp_getset    = Sceadan_getset,
+};
+
+static struct PyModuleDef sceadanmodule = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "sceadan",
+    .m_doc  = "Sceadan data type classification",
+    .m_size = -1,
+};
+
+PyMODINIT_FUNC PyInit_sceadan(void)
+{
+    if(PyType_Ready(&SceadanType)<0) return NULL;
+    PyObject *m = PyModule_Create(&sceadanmodule);
+    if(m==NULL) return NULL;
+    Py_INCREF(&SceadanType);
+    if(PyModule_AddObject(m,"Sceadan",(PyObject *)&SceadanType)<0){
+        Py_DECREF(&SceadanType);
+        Py_DECREF(m);
+        return NULL;
+    }
+    return m;
+}
@@ -0,0 +1,35 @@
+#!/usr/bin/env python3
+#
+# Build the sceadan Python module:
+#
+#    ./configure && make            (in the top directory, for config.h and the model)
+#    cd python && python3 setup.py build_ext --inplace
+#
+# The library sources are compiled into the module, as they are into
+# libsceadan, so the module does not depend on how libsceadan was built.
+
+import os
+from setuptools import setup, Extension
+
+top = os.path.abspath(os.path.join(os.path.dirname(__file__),'..'))
+src = os.path.join(top,'src')
+liblinear = os.path.join(top,'liblinear')
+
+sources = ['sceadanmodule.c',
+           os.path.join(src,'sceadan.cpp'),
+           os.path.join(src,'sceadan_model_precompiled.c'),
+           os.path.join(liblinear,'linear.cpp'),
+           os.path.join(liblinear,'tron.cpp')] + \
+          [os.path.join(liblinear,'blas',fn) for fn in ['daxpy.c','ddot.c','dnrm2.c','dscal.c']]
+
+blob = os.path.join(src,'sceadan_model_precompiled.bin')
+
+setup(name='sceadan',
+      version='1.2.1',
+      description='Sceadan data type classification',
+      ext_modules=[Extension('sceadan',
+                             sources=sources,
+                             include_dirs=[top,src],
+                             define_macros=[('SCEADAN_MODEL_BLOB','"{}"'.format(blob))],
+                             libraries=['m'],
+                             language='c++')])
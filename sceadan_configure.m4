@@ -1,5 +1,26 @@
 ################################################################
 AC_CHECK_HEADERS([linear.h liblinear/linear.h])
+AC_CHECK_HEADERS([sys/mman.h sys/file.h sys/un.h])
+# sceadand checks that clients run as its user
+AC_CHECK_FUNCS([getpeereid])
+# -q reads with io_uring through the raw system calls; liburing is not needed
+AC_CHECK_HEADERS([linux/io_uring.h])
+# -D asks the device for its logical block size
+AC_CHECK_HEADERS([linux/fs.h])
+# -O extent sorts files by their first physical extent
+AC_CHECK_HEADERS([linux/fiemap.h])
+AC_CHECK_FUNCS([flock pread posix_memalign posix_fadvise statx])
+
+# The model registry and the threaded paths use C++11 <mutex>, <thread> and <atomic>
+AC_LANG_PUSH([C++])
+AC_MSG_CHECKING([whether $CXX supports C++11 threads])
+AC_COMPILE_IFELSE([AC_LANG_PROGRAM([[#include <mutex>
+#include <atomic>]],[[std::mutex m; std::lock_guard<std::mutex> g(m); std::atomic<int> i(0); return i.load();]])],
+  [AC_MSG_RESULT([yes])],
+  [CXXFLAGS="$CXXFLAGS -std=c++11"
+   AC_MSG_RESULT([adding -std=c++11])])
+AC_LANG_POP([C++])
+AC_CHECK_LIB([pthread],[pthread_create])
 AC_CHECK_LIB([m],[fmax],,AC_MSG_ERROR([missing -lm]))
 liblinear="no"
 AC_CHECK_LIB([linear],[load_model],
@@ -14,6 +35,12 @@ AC_CHECK_LIB([linear],[load_model],
 if test -f src/sceadan_model_precompiled.dat ; then
   AC_DEFINE(HAVE_SRC_SCEADAN_MODEL_PRECOMPILED_DAT,1,[we have a precompiled model])
 fi
+if test -f src/sceadan_model_precompiled.bin ; then
+  AC_DEFINE(HAVE_SRC_SCEADAN_MODEL_PRECOMPILED_BIN,1,[we have a precompiled binary model])
+fi
+AM_CONDITIONAL([HAVE_MODEL_BIN], [test -f src/sceadan_model_precompiled.bin])
+# sceadand needs Unix domain sockets
+AM_CONDITIONAL([HAVE_SYS_UN_H], [test x"$ac_cv_header_sys_un_h" = x"yes"])
 
 # Check which version of liblinear we have
 AC_CHECK_MEMBER([struct parameter.p], 
@@ -0,0 +1,140 @@
+/*
+ * block_pipeline.cpp:
+ * the reader fills tasks of whole blocks from a pool; workers classify
+ * them in any order; the writer puts them back in sequence and returns
+ * them to the pool. There are never more tasks than the pool holds, so
+ * the reorder buffer is one slot per task and the queues never fill.
+ */
+
+#include "config.h"
+#include "block_pipeline.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define TASK_BYTES (1024*1024)          /* blocks handed to a worker at a time */
+#define TASKS_PER_WORKER 4
+
+block_pipeline::block_pipeline(const sceadan *s_,unsigned workers,size_t block_size_,const output_fn &output_):
+    s(s_),block_size(block_size_),task_size(0),nr_models(sceadan_nr_models(s_)),
+    nr_workers(workers ? workers : 1),output(output_),
+    tasks(TASKS_PER_WORKER*nr_workers+2),
+    free_tasks(tasks.size()),work(tasks.size()+nr_workers),done(tasks.size()+nr_workers),
+    threads(),cur(0),path(),offset(0),next_seq(0),finished(false)
+{
+    task_size = (block_size<TASK_BYTES ? TASK_BYTES/block_size : 1) * block_size;
+    for(size_t i=0;i<tasks.size();i++){
+        tasks[i].buf = (uint8_t *)malloc(task_size);
+        if(tasks[i].buf==0){ perror("malloc"); exit(1); }
+        free_tasks.push(&tasks[i]);
+    }
+    for(unsigned i=0;i<nr_workers;i++) threads.push_back(std::thread(&block_pipeline::worker,this));
+    threads.push_back(std::thread(&block_pipeline::writer,this));
+}
+
+block_pipeline::~block_pipeline()
+{
+    finish();
+    for(size_t i=0;i<tasks.size();i++) free(tasks[i].buf);
+}
+
+void block_pipeline::begin_file(const std::string &path_,uint64_t offset_)
+{
+    end_file();
+    path   = path_;
+    offset = offset_;
+}
+
+void block_pipeline::write(const uint8_t *buf,size_t len)
+{
+    while(len>0){
+        if(cur==0){
+            free_tasks.pop(cur);
+            cur->path   = path;
+            cur->offset = offset;
+            cur->len    = 0;
+        }
+        size_t n = task_size - cur->len;
+        if(n>len) n = len;
+        memcpy(cur->buf+cur->len,buf,n);
+        cur->len += n;
+        offset   += n;
+        buf      += n;
+        len      -= n;
+        if(cur->len==task_size) submit();
+    }
+}
+
+void block_pipeline::end_file()
+{
+    if(cur==0) return;
+    cur->len -= cur->len % block_size;  /* a final partial block is not classified */
+    if(cur->len>0){
+        submit();
+    } else {
+        free_tasks.push(cur);
+        cur = 0;
+    }
+}
+
+void block_pipeline::submit()
+{
+    cur->seq = next_seq++;
+    work.push(cur);
+    cur = 0;
+}
+
+void block_pipeline::finish()
+{
+    if(finished) return;
+    end_file();
+    /* One empty task per worker; each passes it on to the writer after its last block */
+    for(unsigned i=0;i<nr_workers;i++) work.push(0);
+    for(size_t i=0;i<threads.size();i++) threads[i].join();
+    finished = true;
+}
+
+void block_pipeline::worker()
+{
+    sceadan_ctx *ctx = sceadan_ctx_open(s);
+    while(true){
+        task *t;
+        work.pop(t);
+        if(t==0){
+            done.push(0);
+            break;
+        }
+        const size_t nblocks = t->len / block_size;
+        t->types.resize(nblocks*nr_models);
+        for(size_t i=0;i<nblocks;i++){
+            sceadan_ctx_update(ctx,t->buf+i*block_size,block_size);
+            sceadan_ctx_classify_all(ctx,&t->types[i*nr_models]);
+        }
+        done.push(t);
+    }
+    sceadan_ctx_close(ctx);
+}
+
+void block_pipeline::writer()
+{
+    std::vector<task *> reorder(tasks.size(),(task *)0);
+    uint64_t next = 0;
+    unsigned stopped = 0;
+    while(stopped<nr_workers){
+        task *t;
+        done.pop(t);
+        if(t==0){
+            stopped++;
+            continue;
+        }
+        reorder[t->seq % reorder.size()] = t;
+        while((t = reorder[next % reorder.size()]) && t->seq==next){
+            reorder[next % reorder.size()] = 0;
+            for(size_t i=0;i<t->len/block_size;i++){
+                output(t->path,t->offset+i*block_size,&t->types[i*nr_models]);
+            }
+            free_tasks.push(t);
+            next++;
+        }
+    }
+}
@@ -0,0 +1,80 @@
+/*
+ * block_pipeline.h:
+ * classify blocks on several threads. The caller is the reader stage;
+ * workers extract and predict with their own contexts, and a writer
+ * thread reports the blocks in the order they were read.
+ */
+
+#ifndef BLOCK_PIPELINE_H
+#define BLOCK_PIPELINE_H
+
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+#include "bounded_queue.h"
+#include "sceadan.h"
+
+class block_pipeline {
+public:
+    /* Called on the writer thread with one type per model */
+    typedef std::function<void(const std::string &path,uint64_t offset,const int *types)> output_fn;
+
+    block_pipeline(const sceadan *s,unsigned workers,size_t block_size,const output_fn &output);
+    ~block_pipeline();                  /* finishes */
+
+    /* Add bytes of path at offset; blocks may span calls. A file ends
+     * with end_file(), which drops a final partial block.
+     */
+    void begin_file(const std::string &path,uint64_t offset);
+    void write(const uint8_t *buf,size_t len);
+    void end_file();
+
+    /* Wait until every block has been reported */
+    void finish();
+
+private:
+    block_pipeline(const block_pipeline &);
+    block_pipeline &operator=(const block_pipeline &);
+
+    struct task {
+    private:
+        task(const task &);             /* buf is owned by the pipeline */
+        task &operator=(const task &);
+    public:
+        task():seq(0),path(),offset(0),len(0),buf(0),types(){}
+        uint64_t         seq;
+        std::string      path;
+        uint64_t         offset;        /* of the first block */
+        size_t           len;           /* bytes in buf */
+        uint8_t          *buf;
+        std::vector<int> types;         /* nr_models per block */
+    };
+
+    void submit();
+    void worker();
+    void writer();
+
+    const sceadan *s;
+    size_t        block_size;
+    size_t        task_size;            /* whole blocks */
+    int           nr_models;
+    unsigned      nr_workers;
+    output_fn     output;
+
+    std::vector<task> tasks;
+    bounded_queue<task *> free_tasks;
+    bounded_queue<task *> work;
+    bounded_queue<task *> done;
+    std::vector<std::thread> threads;
+
+    task        *cur;                   /* being filled by the reader */
+    std::string path;                   /* of the file being read */
+    uint64_t    offset;                 /* of the next byte written */
+    uint64_t next_seq;
+    bool     finished;
+};
+
+#endif
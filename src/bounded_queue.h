@@ -0,0 +1,94 @@
+/*
+ * bounded_queue.h:
+ * a fixed-size lock-free queue for any number of producers and
+ * consumers (after Dmitry Vyukov's bounded MPMC queue).
+ */
+
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <stddef.h>
+#include <stdint.h>
+
+template <class T>
+class bounded_queue {
+    struct cell {
+        std::atomic<size_t> seq;
+        T data;
+    };
+    cell   *cells;
+    size_t mask;
+    char   pad0[64];                            /* head and tail on their own cache lines */
+    std::atomic<size_t> head;                   /* next cell to pop */
+    char   pad1[64];
+    std::atomic<size_t> tail;                   /* next cell to push */
+    char   pad2[64];
+
+    bounded_queue(const bounded_queue &);
+    bounded_queue &operator=(const bounded_queue &);
+
+    /* Spin briefly, then yield, then sleep, so idle stages do not burn a core */
+    static void backoff(unsigned &tries){
+        if(++tries<16) return;
+        if(tries<64) std::this_thread::yield();
+        else std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+
+public:
+    explicit bounded_queue(size_t capacity):cells(0),mask(0),head(0),tail(0){
+        size_t n = 2;
+        while(n<capacity) n *= 2;
+        cells = new cell[n];
+        for(size_t i=0;i<n;i++) cells[i].seq.store(i,std::memory_order_relaxed);
+        mask = n-1;
+    }
+    ~bounded_queue(){ delete [] cells; }
+
+    bool try_push(const T &v){
+        size_t pos = tail.load(std::memory_order_relaxed);
+        while(true){
+            cell *c = &cells[pos & mask];
+            const size_t seq = c->seq.load(std::memory_order_acquire);
+            const intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if(dif==0){
+                if(tail.compare_exchange_weak(pos,pos+1,std::memory_order_relaxed)){
+                    c->data = v;
+                    c->seq.store(pos+1,std::memory_order_release);
+                    return true;
+                }
+            } else if(dif<0){
+                return false;           /* full */
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool try_pop(T &v){
+        size_t pos = head.load(std::memory_order_relaxed);
+        while(true){
+            cell *c = &cells[pos & mask];
+            const size_t seq = c->seq.load(std::memory_order_acquire);
+            const intptr_t dif = (intptr_t)seq - (intptr_t)(pos+1);
+            if(dif==0){
+                if(head.compare_exchange_weak(pos,pos+1,std::memory_order_relaxed)){
+                    v = c->data;
+                    c->seq.store(pos+mask+1,std::memory_order_release);
+                    return true;
+                }
+            } else if(dif<0){
+                return false;           /* empty */
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void push(const T &v){ unsigned tries = 0; while(!try_push(v)) backoff(tries); }
+    void pop(T &v)       { unsigned tries = 0; while(!try_pop(v)) backoff(tries); }
+};
+
+#endif
@@ -17,6 +17,13 @@
 #include "utf8.h"
 #include <iostream>
 
+#ifndef WIN32
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#endif
+
 #ifndef _TEXT
 #define _TEXT(x) x
 #endif
@@ -55,6 +62,8 @@ bool dig::const_iterator::open(const filename_t &fn)
 #else
     DIR *d = opendir(fn.c_str());
     if(d){
+	struct stat st;
+	if(fstat(dirfd(d),&st)==0) seen.insert(devinode(st.st_dev,st.st_ino));
 	dirstack.push(dirstackelement(fn,d));
 	return false;			// need to read the directory to get the first entry
     }
@@ -77,6 +86,123 @@ bool dig::ignore_file_name(const filename_t &name)
     return name==_TEXT(".") || name==_TEXT("..");
 }
 
+#define SEEN_MIN_SLOTS 1024		// first size of a devinode_set table
+
+size_t dig::const_iterator::devinode_set::slot(const devinode &di) const
+{
+    const size_t mask = table.size()-1;
+    uint64_t h = ((uint64_t)di.dev * 0x9e3779b97f4a7c15ULL) ^ (uint64_t)di.ino;
+    h ^= h >> 33;			// finish as in MurmurHash3
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    size_t i = h & mask;
+    while(!(table[i]==di) && (table[i].dev!=0 || table[i].ino!=0)) i = (i+1) & mask;
+    return i;
+}
+
+bool dig::const_iterator::devinode_set::insert(const devinode &di)
+{
+    if(di.dev==0 && di.ino==0){
+	const bool was = has_zero;
+	has_zero = true;
+	return !was;
+    }
+    if((used+1)*2 > table.size()) grow();
+    const size_t i = slot(di);
+    if(table[i]==di) return false;
+    table[i] = di;
+    used++;
+    return true;
+}
+
+bool dig::const_iterator::devinode_set::contains(const devinode &di) const
+{
+    if(di.dev==0 && di.ino==0) return has_zero;
+    return !table.empty() && table[slot(di)]==di;
+}
+
+void dig::const_iterator::devinode_set::grow()
+{
+    std::vector<devinode> old(table.size() ? table.size()*2 : SEEN_MIN_SLOTS,devinode(0,0));
+    old.swap(table);
+    used = 0;
+    for(size_t i=0;i<old.size();i++){
+	if(old[i].dev!=0 || old[i].ino!=0) insert(old[i]);
+    }
+}
+
+#ifndef WIN32
+/* What a directory entry is. d_type spares the stat of a directory,
+ * which is opened anyway, and tells FIFOs, sockets and devices apart
+ * without one. Files are stat'ed for their device, inode and link
+ * count; symbolic links are followed, as stat() would, and linked
+ * tells that one was. Returns DT_REG or DT_DIR, or DT_UNKNOWN for what
+ * is not processed and what cannot be stat'ed. st is only set for a
+ * file: the caller learns a directory's from the opened directory,
+ * since d_ino of a mount point is that of the directory underneath.
+ */
+static unsigned char entry_type(int dfd,const struct dirent *entry,struct stat &st,bool &linked)
+{
+    int flags = AT_SYMLINK_NOFOLLOW;
+    linked = false;
+#ifdef DT_UNKNOWN
+    switch(entry->d_type){
+    case DT_DIR:
+	return DT_DIR;
+    case DT_REG:
+    case DT_UNKNOWN:
+	break;			// stat it; it may still be a link
+    case DT_LNK:
+	flags = 0;		// stat what it points to
+	linked = true;
+	break;
+    default:
+	return DT_UNKNOWN;	// FIFO, socket or device
+    }
+#endif
+    if(fstatat(dfd,entry->d_name,&st,flags)){
+	return DT_UNKNOWN;	// can't stat it
+    }
+    if(S_ISLNK(st.st_mode)){
+	linked = true;
+	if(fstatat(dfd,entry->d_name,&st,0)) return DT_UNKNOWN; // dangling
+    }
+    if(S_ISDIR(st.st_mode)) return DT_DIR;
+    if(!S_ISREG(st.st_mode)) return DT_UNKNOWN;
+    return DT_REG;
+}
+
+/* The device and inode of the directory holding the file that the
+ * symbolic link name in dirname points to, through any further links.
+ */
+static bool link_target_dir(const dig::filename_t &dirname,const char *name,dig::const_iterator::devinode &di)
+{
+    dig::filename_t path = dirname;
+    path.append(_TEXT("/"));
+    path.append(name);
+    char *real = realpath(path.c_str(),0);
+    if(real==0) return false;
+    char *slash = strrchr(real,'/');
+    slash[slash==real ? 1 : 0] = 0;	// the root keeps its slash
+    struct stat st;
+    const bool ok = stat(real,&st)==0;
+    free(real);
+    if(ok) di = dig::const_iterator::devinode(st.st_dev,st.st_ino);
+    return ok;
+}
+
+/* Open a directory relative to the one being read; st is the opened directory's */
+static DIR *open_dir_at(int dfd,const char *name,struct stat &st)
+{
+    int fd = openat(dfd,name,O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if(fd<0) return 0;
+    DIR *d = 0;
+    if(fstat(fd,&st)==0) d = fdopendir(fd);
+    if(d==0) close(fd);
+    return d;
+}
+#endif
+
 #ifdef WIN32
 bool dig::const_iterator::ignore_file_attributes(const WIN32_FIND_DATA &FindFileData)
 {
@@ -112,8 +238,8 @@ dig::const_iterator & operator++(dig::const_iterator &it)
     }
 
     while(it.dirstack.size()!=0){
-	dig::filename_t filename;		// that is read
 #ifdef WIN32
+	dig::filename_t filename;		// that is read
 	/* MICROSOFT; UTF-16 */
 	WIN32_FIND_DATA FindFileData;
 	memset(&FindFileData,0,sizeof(FindFileData));
@@ -123,17 +249,6 @@ dig::const_iterator & operator++(dig::const_iterator &it)
 	    continue;
 	}
 	filename = FindFileData.cFileName;
-#else
-	/* POSIX; UTF-8 */
-	struct dirent *entry = readdir(it.dirstack.top().dir);
-	if(entry==NULL){		// end of the directory
-	    closedir(it.dirstack.top().dir);
-	    it.dirstack.pop();
-	    it.current_file="";		// see if there is more?
-	    continue;
-	}
-	filename = entry->d_name;
-#endif
 	if(dig::ignore_file_name(filename)){
 	    continue;		// ignore this
 	}
@@ -145,7 +260,6 @@ dig::const_iterator & operator++(dig::const_iterator &it)
 
 	/* Get the device and inode number */
 	struct stat st;
-#if defined(_WIN32) || defined(WIN32)
 	memset(&st,0,sizeof(st));
 	HANDLE filehandle = CreateFile(pathname.c_str(),
 				       0,   // desired access
@@ -159,37 +273,80 @@ dig::const_iterator & operator++(dig::const_iterator &it)
 	CloseHandle(filehandle);
 	st.st_dev = 0;
 	st.st_ino = (((uint64_t)fileinfo.nFileIndexHigh)<<32) | (fileinfo.nFileIndexLow);
-#else
-	if(stat(pathname.c_str(),&st)){
-	    continue;			// can't stat it
-	}
-        if(S_ISFIFO(st.st_mode)) {      // don't process FIFOs
-            continue;                   // 
-        }
-        if(S_ISSOCK(st.st_mode)) {      // don't process sockets
-            continue;                   // 
-        }
-        if(S_ISBLK(st.st_mode)) {      // don't process block devices
-            continue;                   // 
-        }
-        if(S_ISCHR(st.st_mode)) {      // don't process character devices
-            continue;                   // 
-        }
-
-#endif
 	dig::const_iterator::devinode di(st.st_dev,st.st_ino);
 	
-	/* Should this be ignored? */
-	if(it.seen.find(di)!=it.seen.end()){
+	/* Should this be ignored? Well, we've seen it now */
+	if(!it.seen.insert(di)){
 	    continue;			// seen it before; don't process it
 	}
-	/* Well, we've seen it now */
-	it.seen.insert(di);
 
 	/* See if it can be opened list a directory */
 	if(it.open(pathname.c_str())){
 	    return it;				// it's now the current_file
 	}
+#else
+	/* POSIX; UTF-8. d_type saves a stat of most entries, and
+	 * directories are opened relative to their parent, so that only
+	 * what is processed needs a full path name.
+	 */
+	dig::const_iterator::dirstackelement &top = it.dirstack.top();
+	struct dirent *entry = readdir(top.dir);
+	if(entry==NULL){		// end of the directory
+	    closedir(top.dir);
+	    it.dirstack.pop();
+	    it.current_file="";		// see if there is more?
+	    continue;
+	}
+	if(entry->d_name[0]=='.' && (entry->d_name[1]==0 || (entry->d_name[1]=='.' && entry->d_name[2]==0))){
+	    continue;		// ignore . and ..
+	}
+	const int dfd = dirfd(top.dir);
+	struct stat st;
+	bool linked;
+	const unsigned char type = entry_type(dfd,entry,st,linked);
+	if(type==DT_UNKNOWN){
+	    continue;			// not a file or directory
+	}
+	dig::const_iterator::devinode di(0,0);
+	DIR *d = 0;
+	if(type==DT_DIR){
+	    d = open_dir_at(dfd,entry->d_name,st);
+	    if(d==0 && fstatat(dfd,entry->d_name,&st,0)) continue; // gone
+	    di = dig::const_iterator::devinode(st.st_dev,st.st_ino);
+	} else if(st.st_nlink>1){
+	    di = dig::const_iterator::devinode(st.st_dev,st.st_ino);
+	} else if(linked){
+	    /* A file with one name, reached through a symbolic link. If
+	     * the walk has reached its directory, it is listed there;
+	     * otherwise it is remembered, so that it is not listed there.
+	     */
+	    dig::const_iterator::devinode dir(0,0);
+	    if(link_target_dir(top.name,entry->d_name,dir) && it.seen.contains(dir)) continue;
+	    di = dig::const_iterator::devinode(st.st_dev,st.st_ino);
+	    it.linked_files = true;
+	} else if(it.linked_files && it.seen.contains(dig::const_iterator::devinode(st.st_dev,st.st_ino))){
+	    continue;			// listed through a symbolic link
+	}
+
+	/* Should this be ignored? Well, we've seen it now */
+	if((di.dev!=0 || di.ino!=0) && !it.seen.insert(di)){
+	    if(d) closedir(d);
+	    continue;			// seen it before; don't process it
+	}
+
+	/* Get the full path name */
+	dig::filename_t pathname = top.name;
+	pathname.append(_TEXT("/"));
+	pathname.append(entry->d_name);
+
+	if(d){
+	    it.dirstack.push(dig::const_iterator::dirstackelement(pathname,d));
+	    continue;			// read the directory for its first entry
+	}
+	/* A file, or a directory that can't be read, which is reported when it is processed */
+	it.current_file = pathname;
+	return it;
+#endif
     }
     return it;				// reached the end
 }
@@ -230,6 +387,133 @@ dig::dig(const std::string &start_):start(utf8to16(start_))
 }
 #endif
 
+#ifndef WIN32
+#define PARALLEL_QUEUE 4096		// files found but not yet taken by next()
+
+parallel_dig::parallel_dig(const dig::filename_t &start,unsigned nthreads):
+    seen(),seen_mutex(),linked_files(false),dirs(),pending(0),dirs_mutex(),dirs_cv(),files(PARALLEL_QUEUE),done(false),threads()
+{
+    /* Like dig, a start that is not a directory is the only file */
+    struct stat st;
+    if(stat(start.c_str(),&st)==0 && S_ISDIR(st.st_mode)){
+	seen.insert(dig::const_iterator::devinode(st.st_dev,st.st_ino));
+	dirs.push_back(start);
+	pending = 1;
+    } else {
+	files.push(new dig::filename_t(start));
+    }
+    if(nthreads<1) nthreads = 1;
+    if(pending==0){
+	done = true;
+	return;
+    }
+    for(unsigned i=0;i<nthreads;i++) threads.push_back(std::thread(&parallel_dig::lister,this));
+}
+
+parallel_dig::~parallel_dig()
+{
+    /* Drain the queue so that no lister waits on it */
+    dig::filename_t fn;
+    while(next(fn)){
+    }
+    for(size_t i=0;i<threads.size();i++) threads[i].join();
+}
+
+bool parallel_dig::next(dig::filename_t &fn)
+{
+    dig::filename_t *p = 0;
+    unsigned tries = 0;
+    while(!files.try_pop(p)){
+	if(done.load()){
+	    if(files.try_pop(p)) break;	// pushed before done was set
+	    return false;
+	}
+	if(++tries>64) std::this_thread::sleep_for(std::chrono::microseconds(50));
+	else std::this_thread::yield();
+    }
+    fn = *p;
+    delete p;
+    return true;
+}
+
+void parallel_dig::lister()
+{
+    while(true){
+	dig::filename_t dirname;
+	{
+	    std::unique_lock<std::mutex> lock(dirs_mutex);
+	    dirs_cv.wait(lock,[this]{ return !dirs.empty() || pending==0; });
+	    if(dirs.empty()) return;	// pending==0: everything is listed
+	    dirname = dirs.front();
+	    dirs.pop_front();
+	}
+	list(dirname);
+	std::lock_guard<std::mutex> lock(dirs_mutex);
+	if(--pending==0){
+	    done = true;
+	    dirs_cv.notify_all();
+	}
+    }
+}
+
+/* Queue the files of a directory and the directories in it, skipping what was seen */
+void parallel_dig::list(const dig::filename_t &dirname)
+{
+    DIR *d = opendir(dirname.c_str());
+    if(d==0) return;
+    const int dfd = dirfd(d);
+    struct stat st;
+    struct dirent *entry;
+    while((entry = readdir(d))!=0){
+	if(entry->d_name[0]=='.' && (entry->d_name[1]==0 || (entry->d_name[1]=='.' && entry->d_name[2]==0))){
+	    continue;		// ignore . and ..
+	}
+	bool linked;
+	const unsigned char type = entry_type(dfd,entry,st,linked);
+	if(type==DT_UNKNOWN){
+	    continue;			// not a file or directory
+	}
+	dig::const_iterator::devinode di(0,0);
+	if(type==DT_DIR){
+	    /* The directory is opened later, perhaps on another thread */
+	    if(fstatat(dfd,entry->d_name,&st,0)) continue;
+	    di = dig::const_iterator::devinode(st.st_dev,st.st_ino);
+	} else if(st.st_nlink>1){
+	    di = dig::const_iterator::devinode(st.st_dev,st.st_ino);
+	} else if(linked){
+	    /* As in dig; a directory is in seen before it is listed */
+	    dig::const_iterator::devinode dir(0,0);
+	    const bool found = link_target_dir(dirname,entry->d_name,dir);
+	    std::lock_guard<std::mutex> lock(seen_mutex);
+	    if(found && seen.contains(dir)) continue;
+	    di = dig::const_iterator::devinode(st.st_dev,st.st_ino);
+	    linked_files = true;
+	} else if(linked_files.load()){
+	    std::lock_guard<std::mutex> lock(seen_mutex);
+	    if(seen.contains(dig::const_iterator::devinode(st.st_dev,st.st_ino))) continue;
+	}
+	if(di.dev!=0 || di.ino!=0){
+	    std::lock_guard<std::mutex> lock(seen_mutex);
+	    if(!seen.insert(di)){
+		continue;		// seen it before; don't process it
+	    }
+	}
+	dig::filename_t pathname = dirname;
+	pathname.append(_TEXT("/"));
+	pathname.append(entry->d_name);
+	if(type==DT_DIR){
+	    std::lock_guard<std::mutex> lock(dirs_mutex);
+	    dirs.push_back(pathname);
+	    pending++;
+	    dirs_cv.notify_one();
+	} else {
+	    files.push(new dig::filename_t(pathname));
+	}
+    }
+    closedir(d);
+}
+#endif
+
 #ifdef STANDALONE
 
 int main(int argc,char **argv)
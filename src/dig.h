@@ -10,10 +10,19 @@
 #include <stack>
 #include <dirent.h>
 #include <iostream>
-#include <set>
+#include <vector>
 #include <sys/stat.h>
 #include <stdint.h>
 
+#ifndef WIN32
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include "bounded_queue.h"
+#endif
+
 #if defined(WIN32) || defined(MINGW) || defined(__MINGW32__) || defined(__MINGW64__)
 #include <windows.h>
 #include <windowsx.h>
@@ -37,12 +46,34 @@ public:
 	class devinode {
 	public:
 	    devinode(dev_t dev_,ino_t ino_):dev(dev_),ino(ino_){}
-	    devinode(const devinode &di):dev(di.dev),ino(di.ino){}
 	    dev_t dev;
 	    ino_t ino;
 	    bool operator<(const devinode t2) const{
 		return this->dev < t2.dev || (this->dev==t2.dev && this->ino < t2.ino);
 	    }
+	    bool operator==(const devinode t2) const{
+		return this->dev==t2.dev && this->ino==t2.ino;
+	    }
+	};
+	/* What must not be repeated: directories, which could loop,
+	 * files with more than one link, and files reached through a
+	 * symbolic link. Any other file is reached by one name, so it is
+	 * not kept, and memory grows with the directories, hard links and
+	 * symbolic links rather than with every file. The table is
+	 * open-addressed, a devinode per slot.
+	 */
+	class devinode_set {
+	public:
+	    devinode_set():table(),used(0),has_zero(false){}
+	    bool insert(const devinode &di);	// false if it was already there
+	    bool contains(const devinode &di) const;
+	    size_t size() const { return used + (has_zero ? 1 : 0); }
+	private:
+	    size_t slot(const devinode &di) const; // where di is, or would go
+	    void grow();
+	    std::vector<devinode> table;	// empty slots are devinode(0,0)
+	    size_t used;
+	    bool   has_zero;			// devinode(0,0) itself was inserted
 	};
 	class dirstackelement {
 	private:
@@ -61,16 +92,17 @@ public:
 #endif
 	};
 
-	std::set<devinode> seen;	// things not to repeat
+	devinode_set seen;		// things not to repeat
 	std::stack<dirstackelement>dirstack;	// stack of open directories
 	filename_t current_file;	// file I'm supposed to get
 	bool ready;			// has this file been processed?
+	bool linked_files;		// seen holds files reached through symbolic links
 
     public:
 	const_iterator():
-	    seen(),dirstack(),current_file(),ready(false){ };
+	    seen(),dirstack(),current_file(),ready(false),linked_files(false){ };
 	const_iterator(filename_t current_file_):
-	    seen(),dirstack(),current_file(current_file_),ready(false){ };
+	    seen(),dirstack(),current_file(current_file_),ready(false),linked_files(false){ };
 	bool operator == (const const_iterator &i2);
 	bool operator != (const const_iterator &i2) { return !(*this == i2); };
 	filename_t operator*();		// returns the file currently pointed to
@@ -90,4 +122,36 @@ public:
 
 };
 dig::const_iterator & operator++(dig::const_iterator &it);
+
+#ifndef WIN32
+/*
+ * parallel_dig lists directories on several threads, so sibling
+ * directories are read concurrently, and queues the files it finds
+ * for next(). Files come out in no particular order, but each only
+ * once, as with dig.
+ */
+class parallel_dig {
+public:
+    parallel_dig(const dig::filename_t &start,unsigned threads);
+    ~parallel_dig();
+    bool next(dig::filename_t &fn);	// false when every directory has been listed
+private:
+    parallel_dig(const parallel_dig &);
+    parallel_dig &operator=(const parallel_dig &);
+    void lister();
+    void list(const dig::filename_t &dirname);
+
+    dig::const_iterator::devinode_set seen; // things not to repeat
+    std::mutex seen_mutex;
+    std::atomic<bool> linked_files;	// seen holds files reached through symbolic links
+    std::deque<dig::filename_t> dirs;	// directories waiting to be listed
+    size_t pending;			// directories queued or being listed
+    std::mutex dirs_mutex;
+    std::condition_variable dirs_cv;
+    bounded_queue<dig::filename_t *> files;
+    std::atomic<bool> done;		// every directory has been listed
+    std::vector<std::thread> threads;
+};
+#endif
+
 #endif
@@ -0,0 +1,91 @@
+/*
+ * file_scheduler.cpp:
+ * per-worker deques under their own small locks; idle workers poll
+ * briefly rather than sleeping on a shared condition, so the adding
+ * thread never contends with them.
+ */
+
+#include "config.h"
+#include "file_scheduler.h"
+
+#include <chrono>
+
+#define MAX_PENDING 65536               /* add() waits for the workers beyond this */
+#define IDLE_SLEEP  std::chrono::microseconds(200)
+
+file_scheduler::file_scheduler(unsigned workers,const run_fn &run_):
+    run(run_),queues(),threads(),pending(0),adding(true),next(0)
+{
+    if(workers<1) workers = 1;
+    for(unsigned i=0;i<workers;i++) queues.push_back(new queue());
+    for(unsigned i=0;i<workers;i++) threads.push_back(std::thread(&file_scheduler::worker,this,i));
+}
+
+file_scheduler::~file_scheduler()
+{
+    finish();
+    for(size_t i=0;i<queues.size();i++) delete queues[i];
+}
+
+void file_scheduler::add(const task &t)
+{
+    while(pending.load()>=MAX_PENDING) std::this_thread::sleep_for(IDLE_SLEEP);
+    pending++;
+    queue *q = queues[next];
+    next = (next+1) % queues.size();
+    std::lock_guard<std::mutex> lock(q->mutex);
+    q->tasks.push_back(t);
+}
+
+void file_scheduler::spawn(unsigned worker,const task &t)
+{
+    pending++;
+    queue *q = queues[worker];
+    std::lock_guard<std::mutex> lock(q->mutex);
+    q->tasks.push_back(t);
+}
+
+/* The newest task of our own deque, or the oldest of someone else's */
+bool file_scheduler::take(unsigned worker,task &t)
+{
+    {
+        queue *q = queues[worker];
+        std::lock_guard<std::mutex> lock(q->mutex);
+        if(!q->tasks.empty()){
+            t = q->tasks.back();
+            q->tasks.pop_back();
+            return true;
+        }
+    }
+    for(size_t i=1;i<queues.size();i++){
+        queue *q = queues[(worker+i) % queues.size()];
+        std::lock_guard<std::mutex> lock(q->mutex);
+        if(!q->tasks.empty()){
+            t = q->tasks.front();
+            q->tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void file_scheduler::worker(unsigned w)
+{
+    task t;
+    while(true){
+        if(take(w,t)){
+            run(w,t);
+            pending--;
+            continue;
+        }
+        if(!adding.load() && pending.load()==0) break;
+        std::this_thread::sleep_for(IDLE_SLEEP);
+    }
+}
+
+void file_scheduler::finish()
+{
+    adding = false;
+    for(size_t i=0;i<threads.size();i++) threads[i].join();
+    threads.clear();
+}
@@ -0,0 +1,61 @@
+/*
+ * file_scheduler.h:
+ * run scan tasks on several threads. Each worker has its own deque:
+ * it takes its newest task from the back, and when it runs dry it
+ * steals the oldest task from the front of another worker's deque.
+ * Tasks are added while earlier ones run, so discovery overlaps with
+ * the work, and a worker may split a task into tasks on its own deque.
+ */
+
+#ifndef FILE_SCHEDULER_H
+#define FILE_SCHEDULER_H
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+class file_scheduler {
+public:
+    struct task {
+        task():path(),offset(0),length(0){}
+        task(const std::string &path_,uint64_t offset_,uint64_t length_):path(path_),offset(offset_),length(length_){}
+        std::string path;
+        uint64_t    offset;
+        uint64_t    length;             /* 0: the whole file, as discovered */
+    };
+    typedef std::function<void(unsigned worker,const task &t)> run_fn;
+
+    file_scheduler(unsigned workers,const run_fn &run);
+    ~file_scheduler();                  /* finishes */
+
+    void add(const task &t);            /* from the discovering thread; waits while too much is pending */
+    void spawn(unsigned worker,const task &t); /* from a running task, onto its worker's deque */
+    void finish();                      /* no more add(); wait until every task has run */
+    unsigned nr_workers() const { return queues.size(); }
+
+private:
+    file_scheduler(const file_scheduler &);
+    file_scheduler &operator=(const file_scheduler &);
+
+    struct queue {
+        queue():mutex(),tasks(){}
+        std::mutex       mutex;
+        std::deque<task> tasks;
+    };
+    bool take(unsigned worker,task &t);
+    void worker(unsigned w);
+
+    run_fn                   run;
+    std::vector<queue *>     queues;
+    std::vector<std::thread> threads;
+    std::atomic<size_t>      pending;   /* tasks added or spawned that have not finished */
+    std::atomic<bool>        adding;
+    unsigned                 next;      /* deque for the next add() */
+};
+
+#endif
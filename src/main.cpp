@@ -48,19 +48,39 @@
 #include <inttypes.h>
 #include <assert.h>
 
+#include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#ifdef HAVE_LINUX_FS_H
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+#ifdef HAVE_LINUX_FIEMAP_H
+#include <linux/fiemap.h>
+#endif
 #include <string.h>
 #include <stdlib.h>
 #include <getopt.h>
 #include <limits.h>
+#include <math.h>
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
 
 #include "utf8.h"
 #include "dig.h"
+#include "ring_reader.h"
+#include "block_pipeline.h"
+#include "file_scheduler.h"
 
 #ifndef O_BINARY
 #define O_BINARY 0
@@ -70,6 +90,13 @@
 
 /* Globals for the stand-alone program */
 
+#define READ_CHUNK_SIZE (4*1024*1024)   /* bytes read at a time; blocks are sliced from it */
+#define DIRECT_MAX_ALIGN 4096           /* buffers are aligned for O_DIRECT up to this logical block size */
+#define SAMPLE_Z         1.96           /* normal quantile of the 95% confidence intervals of -p */
+#define SPLIT_SIZE       (64*1024*1024) /* with -W -b, larger files are classified in ranges of this size */
+#define HOLE_CHUNK_SIZE  65536          /* zeros handed to -w workers at a time for a hole */
+#define ORDER_BATCH      65536          /* with -O, files found are sorted this many at a time */
+
 ssize_t block_size = 512;
 int    opt_json = 0;
 int    opt_train = 0;
@@ -80,19 +107,153 @@ int    opt_preport  = 0;        /* report percentage sampled to pfd */
 int    opt_seed = 0;                    /* random number seed */
 int    opt_reduce = 0;          /* top n feature to select while doing feature reduction */
 int    opt_debug = 0;
+int    opt_early = 0;           /* whole-file mode: stop reading once the prediction is stable */
+int    opt_direct = 0;          /* read with O_DIRECT */
+int    opt_threads = 0;         /* -w: classify blocks on this many threads */
+int    opt_scan_threads = 0;    /* -W: scan files on this many threads */
+int    opt_dig_threads = 0;     /* -L: list directories on this many threads */
+#define ORDER_INODE  1
+#define ORDER_EXTENT 2
+int    opt_order = 0;           /* -O: ORDER_INODE or ORDER_EXTENT */
+double opt_sample_percent = 0;  /* -p N%: classify a random N percent of the blocks */
+uint64_t opt_sample_count = 0;  /* -p N: classify N random blocks */
 
 const char *feature_mask_file_in  = 0;
 const char *feature_mask_file_out = 0;
+const char *opt_bundle_out = 0;         /* write the opened model as a bundle */
+const char *opt_stats = 0;              /* feature statistics file */
+int    opt_select = SCEADAN_SELECT_ANOVA_F;     /* statistic used with -S and -R */
 const char *opt_class_file = 0;
 const char *opt_model = 0;
+std::vector<std::string> opt_extra_models;   /* -M model[,classfile[,maskfile]] */
 
 static sceadan *s = 0;                         /* the sceadan we are using */
+static ring_reader *ring = 0;                  /* io_uring reads with -q */
+static block_pipeline *pipeline = 0;           /* block classification on -w threads */
+static file_scheduler *scheduler = 0;          /* files scanned on -W threads */
+static std::vector<int> zero_types;            /* of an all-zero block by s; found at the first hole */
 
-static void do_output(sceadan *sc,const char *path,uint64_t offset,int file_type )
+/* One line per classification; with several models there is one type per model */
+static void format_output(std::string &out,sceadan *sc,const char *path,uint64_t offset,const int *file_types)
 {
-    printf("%-10" PRId64 " %s # %s\n", offset,sceadan_name_for_type(sc,file_type),path);
+    char num[32];
+    snprintf(num,sizeof(num),"%-10" PRId64 " ", offset);
+    out += num;
+    for(int i=0;i<sceadan_nr_models(sc);i++){
+        out += sceadan_name_for_model_type(sc,i,file_types[i]);
+        out += ' ';
+    }
+    out += "# ";
+    out += path;
+    out += '\n';
 }
 
+static void do_output(sceadan *sc,const char *path,uint64_t offset,const int *file_types )
+{
+    std::string line;
+    format_output(line,sc,path,offset,file_types);
+    fputs(line.c_str(),stdout);
+}
+
+
+
+/* The alignment O_DIRECT reads of fd need: the logical block size of
+ * the device, or of the device under the file when the kernel says.
+ */
+static size_t direct_alignment(int fd)
+{
+    struct stat st;
+    if(fstat(fd,&st)<0) return 0;
+#if defined(HAVE_LINUX_FS_H) && defined(BLKSSZGET)
+    int ssz = 0;
+    if(S_ISBLK(st.st_mode) && ioctl(fd,BLKSSZGET,&ssz)==0 && ssz>0) return ssz;
+#endif
+#if defined(HAVE_STATX) && defined(STATX_DIOALIGN)
+    struct statx stx;
+    if(statx(fd,"",AT_EMPTY_PATH,STATX_DIOALIGN,&stx)==0 && (stx.stx_mask & STATX_DIOALIGN)){
+        if(stx.stx_dio_offset_align==0) return 0;   /* no direct I/O on this file */
+        return std::max(stx.stx_dio_offset_align,stx.stx_dio_mem_align);
+    }
+#endif
+    return DIRECT_MAX_ALIGN;
+}
+
+
+/* Classify a seeded random sample of the blocks of fd from start on,
+ * in file order with pread(), and print for each type of the primary
+ * model the share of the sampled blocks with a 95% Wilson interval,
+ * corrected for sampling without replacement. When producing vectors,
+ * only the vectors of the sampled blocks are written.
+ */
+static int sample_file(const char *path,int fd,uint64_t start,int training)
+{
+    const off_t size = lseek(fd,0,SEEK_END);
+    if(size<0){
+        fprintf(stderr,"%s: cannot sample a file that cannot seek\n",path);
+        return -1;
+    }
+    const uint64_t nblocks = (uint64_t)size>start ? ((uint64_t)size-start)/block_size : 0;
+    uint64_t n = opt_sample_count ? opt_sample_count : (uint64_t)ceil(nblocks*opt_sample_percent/100.0);
+    if(n>nblocks) n = nblocks;
+
+    /* Floyd's algorithm draws n distinct blocks; mt19937_64 makes the
+     * sample the same for a seed on every platform.
+     */
+    std::mt19937_64 rng(opt_seed);
+    std::set<uint64_t> picked;
+    for(uint64_t j=nblocks-n;j<nblocks;j++){
+        const uint64_t r = rng() % (j+1);
+        if(!picked.insert(r).second) picked.insert(j);
+    }
+
+    std::vector<uint8_t> buf(block_size);
+    std::vector<int> types(sceadan_nr_models(s));
+    std::map<int,uint64_t> counts;
+    uint64_t skipped = 0;
+    for(std::set<uint64_t>::const_iterator it=picked.begin();it!=picked.end();++it){
+        const uint64_t offset = start + *it * block_size;
+#ifdef HAVE_PREAD
+        const ssize_t rd = pread(fd,&buf[0],block_size,offset);
+#else
+        const ssize_t rd = (lseek(fd,offset,SEEK_SET)<0) ? -1 : read(fd,&buf[0],block_size);
+#endif
+        if(rd!=block_size){             /* left out of the sample */
+            fprintf(stderr,"%s: cannot read block at %" PRIu64 ": %s\n",path,offset,
+                    rd<0 ? strerror(errno) : "short read");
+            skipped++;
+            continue;
+        }
+        sceadan_update(s,&buf[0],block_size);
+        sceadan_classify_all(s,&types[0]);
+        counts[types[0]]++;
+        if(opt_preport) fprintf(stderr,"%" PRIu64 "-%" PRIu64 "\n",offset,offset+block_size);
+    }
+    n -= skipped;
+    if(training) return 0;
+
+    printf("# %s: %" PRIu64 " of %" PRIu64 " blocks of %zd bytes (seed %d)\n",path,n,nblocks,block_size,opt_seed);
+    std::vector<std::pair<uint64_t,int> > order;
+    for(std::map<int,uint64_t>::const_iterator it=counts.begin();it!=counts.end();++it){
+        order.push_back(std::make_pair(it->second,it->first));
+    }
+    std::sort(order.rbegin(),order.rend());
+    const double fpc = nblocks>1 ? sqrt((double)(nblocks-n)/(nblocks-1)) : 0;
+    const double z2  = SAMPLE_Z*SAMPLE_Z;
+    for(size_t i=0;i<order.size();i++){
+        const double p = (double)order[i].first/n;
+        double low = p, high = p;
+        if(fpc>0){
+            const double center = (p + z2/(2*n))/(1 + z2/n);
+            const double half   = SAMPLE_Z/(1 + z2/n) * sqrt(p*(1-p)/n + z2/(4.0*n*n)) * fpc;
+            low  = std::max(0.0,center-half);
+            high = std::min(1.0,center+half);
+        }
+        printf("%-10s %10" PRIu64 " %6.2f%% [%6.2f%% - %6.2f%%] ~%" PRIu64 " bytes\n",
+               sceadan_name_for_type(s,order[i].second),order[i].first,100*p,100*low,100*high,
+               (uint64_t)(p*nblocks*block_size));
+    }
+    return 0;
+}
 
 
 /**
@@ -114,13 +275,12 @@ static int process_file(const char path[])
     }
 
     /* Test the incremental classifier */
-    const int fd = (strcmp(path,"-")==0) ? STDIN_FILENO : open(path, O_RDONLY|O_BINARY);
+    int fd = (strcmp(path,"-")==0) ? STDIN_FILENO : open(path, O_RDONLY|O_BINARY);
     if (fd<0){
         fprintf(stderr,"cannot open %s\n",path);
         return -1;
     }
-    uint8_t   *buf = (uint8_t *)malloc(block_size);
-    if(buf==0){ perror("malloc"); exit(1); }
+    std::vector<int> types(sceadan_nr_models(s));
         
     /* Read the file one block at a time */
     uint64_t offset = 0;
@@ -130,43 +290,372 @@ static int process_file(const char path[])
         lseek(fd,block_size,SEEK_SET);
         offset += block_size;
     }
-    while(true){
-        const ssize_t rd = read(fd, buf, block_size);
-        
-        if(opt_debug) fprintf(stderr,"Read %02x %02x %02x %02x %02x %02x %02x %02x\n",
-                              buf[0],buf[1],buf[2],buf[3],buf[4],buf[5],buf[6],buf[7]);
-        
-        if(rd==-1){ perror("read"); exit(0);}
 
-        /* if we read data, update the vectors */
-        if(rd>0){
-            sceadan_update(s,buf,rd); 
+    /* A random sample of the blocks */
+    if(opt_sample_count || opt_sample_percent>0){
+        const int ret = sample_file(path,fd,offset,training);
+        sceadan_clear(s);
+        if(fd) close(fd);
+        return ret;
+    }
+
+    /* Whole-file classification that stops once growing prefixes agree */
+    if(opt_early && !opt_blocks && !training){
+        uint64_t nread = 0;
+        if(sceadan_classify_fd_prefix(s,fd,&types[0],&nread)<0){
+            perror(path);
+        } else {
+            do_output(s,path,0,&types[0]);
+            if(opt_preport) fprintf(stderr,"%" PRIu64 "-%" PRIu64 "\n",offset,offset+nread);
         }
-        /* Print the results if we are classifying each block and we read a complete block,
-         * or if we are not classifying each block and we read nothing (meaning we are at the end)
-         *
-         * sceadan_classify() clears the vectors.
-         */
-
-        if((opt_blocks && rd==block_size) ||
-           (!opt_blocks && rd==0)){
-
-            int t = sceadan_classify(s);
-            uint64_t start  = opt_blocks ? offset : 0;
-            if(!training) do_output(s,path,start,t); /* print results if not producing vectors for training*/
-            if(opt_preport) fprintf(stderr,"%" PRIu64 "-%" PRIu64 "\n",offset,offset+rd);
+        if(fd) close(fd);
+        return 0;
+    }
+
+#ifdef HAVE_POSIX_FADVISE
+    posix_fadvise(fd,0,0,POSIX_FADV_SEQUENTIAL);
+#endif
+
+    /* With -D, read around the page cache. O_DIRECT reads start on a
+     * logical block, so -x reads from the block before its offset and
+     * skip drops the bytes in front of it.
+     */
+    size_t align = 1;
+    size_t skip  = 0;
+#ifdef O_DIRECT
+    if(opt_direct && fd!=STDIN_FILENO){
+        const int dfd = open(path, O_RDONLY|O_BINARY|O_DIRECT);
+        const size_t a = dfd>=0 ? direct_alignment(dfd) : 0;
+        if(a>0 && a<=DIRECT_MAX_ALIGN){
+            const uint64_t start = opt_omit ? block_size : 0;
+            skip  = start % a;
+            if(lseek(dfd,start-skip,SEEK_SET)>=0){
+                close(fd);
+                fd    = dfd;
+                align = a;
+            } else {
+                close(dfd);
+            }
+        } else {
+            if(dfd>=0) close(dfd);
+            if(opt_debug) fprintf(stderr,"%s: no direct I/O; reading through the page cache\n",path);
         }
-        /* If we read nothing, break out of the loop */
-        if(rd==0) break;
-        offset += rd;
+        if(align==1) skip = 0;
+    }
+#endif
+
+    /* Read large chunks into a buffer that is kept for the next file,
+     * and hand the classifier block-sized slices of it. A block can
+     * span two chunks.
+     */
+    ssize_t in_block = 0;               /* bytes of the current block given to sceadan_update() */
+    if(pipeline) pipeline->begin_file(path,offset);
+    auto consume = [&](const uint8_t *p,size_t rd){ /* p==0: rd zeros, which are not scanned */
+        if(skip>0){
+            const size_t n = std::min(skip,rd);
+            if(p) p += n;
+            rd   -= n;
+            skip -= n;
+        }
+        if(pipeline){                   /* -w: the workers classify the blocks */
+            pipeline->write(p,rd);
+            return;
+        }
+        ssize_t left = rd;
+        while(left>0){
+            const ssize_t n = opt_blocks ? std::min(left, block_size - in_block) : left;
+            if(opt_debug && p && (!opt_blocks || in_block==0)) fprintf(stderr,"Read %02x %02x %02x %02x %02x %02x %02x %02x\n",
+                                                                p[0],p[1],p[2],p[3],p[4],p[5],p[6],p[7]);
+            if(p){
+                sceadan_update(s,p,n); 
+                p += n;
+            } else {
+                sceadan_update_zeros(s,n);
+            }
+            left     -= n;
+            in_block += n;
+
+            /* Print the results if we are classifying each block and we have a complete block.
+             * sceadan_classify() clears the vectors.
+             */
+            if(opt_blocks && in_block==block_size){
+                sceadan_classify_all(s,&types[0]);
+                if(!training) do_output(s,path,offset,&types[0]); /* print results if not producing vectors for training*/
+                if(opt_preport) fprintf(stderr,"%" PRIu64 "-%" PRIu64 "\n",offset,offset+block_size);
+                offset  += block_size;
+                in_block = 0;
+            }
+        }
+        if(!opt_blocks) offset += rd;
+    };
+
+    /* A hole reads as zeros; it is counted without reading it. A whole
+     * block of zeros is not classified either: it gets the types of the
+     * first one, which are kept for the run. Only the -w workers are
+     * handed the zeros themselves.
+     */
+    auto consume_hole = [&](uint64_t len){
+        static const uint8_t zeros[HOLE_CHUNK_SIZE] = {0};
+        if(skip>0){
+            const size_t n = std::min<uint64_t>(skip,len);
+            len  -= n;
+            skip -= n;
+        }
+        while(len>0){
+            if(opt_blocks && !pipeline && !training && in_block==0 && len>=(uint64_t)block_size){
+                if(zero_types.empty()){
+                    sceadan_update_zeros(s,block_size);
+                    zero_types.resize(types.size());
+                    sceadan_classify_all(s,&zero_types[0]);
+                }
+                do_output(s,path,offset,&zero_types[0]);
+                if(opt_preport) fprintf(stderr,"%" PRIu64 "-%" PRIu64 "\n",offset,offset+block_size);
+                offset += block_size;
+                len    -= block_size;
+                continue;
+            }
+            if(pipeline){
+                const uint64_t n = std::min<uint64_t>(len,HOLE_CHUNK_SIZE);
+                consume(zeros,n);
+                len -= n;
+                continue;
+            }
+            uint64_t n = std::min<uint64_t>(len,SSIZE_MAX);
+            if(opt_blocks) n = std::min<uint64_t>(n,block_size-in_block);
+            consume(0,n);
+            len -= n;
+        }
+    };
+
+    /* Page aligned, as O_DIRECT needs */
+    static uint8_t *buf = 0;
+    if(buf==0){
+#ifdef HAVE_POSIX_MEMALIGN
+        if(posix_memalign((void **)&buf,DIRECT_MAX_ALIGN,READ_CHUNK_SIZE)!=0) buf = 0;
+#else
+        buf = (uint8_t *)malloc(READ_CHUNK_SIZE);
+#endif
+        if(buf==0){ perror("malloc"); exit(1); }
+    }
+
+    /* Read from the file position for length bytes, or to the end. With
+     * -q, files and devices are read through io_uring; pipes are read as
+     * before. False at the end of the file.
+     */
+    struct stat st;
+    const bool have_stat = fstat(fd,&st)==0;
+    const bool use_ring  = ring && ring->ok() && have_stat && (S_ISREG(st.st_mode) || S_ISBLK(st.st_mode));
+    auto read_range = [&](uint64_t length)->bool {
+        off_t pos;
+        if(use_ring && (pos = lseek(fd,0,SEEK_CUR))>=0){
+            if(ring->read_fd(fd,pos,consume,align,length)<0){ perror("read"); exit(0);}
+            return length!=UINT64_MAX;
+        }
+        while(length>0){
+            size_t want = std::min<uint64_t>(length,READ_CHUNK_SIZE);
+            want = std::min<size_t>((want+align-1)/align*align,READ_CHUNK_SIZE);
+            const ssize_t rd = read(fd, buf, want);
+            if(rd==-1){ perror("read"); exit(0);}
+            if(rd==0) return false;
+            consume(buf,std::min<uint64_t>(rd,length));
+            if(length!=UINT64_MAX) length -= std::min<uint64_t>(rd,length);
+            /* A direct read stops short only at the end, which need not be aligned */
+            if(align>1 && (size_t)rd<want) return false;
+        }
+        return true;
+    };
+
+    /* A sparse file is read one data extent at a time */
+    off_t pos = -1;
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    if(have_stat && S_ISREG(st.st_mode)) pos = lseek(fd,0,SEEK_CUR);
+#endif
+    if(pos>=0){
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+        while(pos<st.st_size){
+            off_t data = lseek(fd,pos,SEEK_DATA);
+            if(data<0 && errno==ENXIO) data = st.st_size;   /* a hole to the end */
+            off_t hole = (data>=0 && data<st.st_size) ? lseek(fd,data,SEEK_HOLE) : st.st_size;
+            if(data<0 || hole<0){
+                /* The file system cannot tell; read the rest */
+                if(lseek(fd,pos,SEEK_SET)>=0) read_range(UINT64_MAX);
+                break;
+            }
+            if(data>pos) consume_hole(data-pos);
+            if(data>=st.st_size) break;
+            if(lseek(fd,data,SEEK_SET)<0 || !read_range(hole-data)) break;
+            pos = hole;
+        }
+#endif
+    } else {
+        read_range(UINT64_MAX);
+    }
+
+    /* At the end. Not classifying each block, we classify what we read;
+     * classifying each block, a final partial block is dropped.
+     */
+    if(pipeline){
+        pipeline->end_file();
+    } else if(!opt_blocks){
+        sceadan_classify_all(s,&types[0]);
+        if(!training) do_output(s,path,0,&types[0]);
+        if(opt_preport) fprintf(stderr,"%" PRIu64 "-%" PRIu64 "\n",offset,offset);
     }
-    free(buf);
     sceadan_clear(s);
     if(fd) close(fd);
     return 0;
 }
 
 
+/* -W: classify one file, or one range of a large file, on a scheduler
+ * worker. A file over SPLIT_SIZE is split into ranges of whole blocks
+ * that other workers can steal. The lines of a task are printed
+ * together; tasks finish in any order.
+ */
+struct scan_worker {
+    sceadan_ctx *ctx;
+    uint8_t     *buf;
+    std::vector<int> zero_types;        /* of an all-zero block; found at the first hole */
+};
+static std::vector<scan_worker> scan_workers;
+static std::mutex output_mutex;
+
+static void scan_task(unsigned worker,const file_scheduler::task &t)
+{
+    const int fd = open(t.path.c_str(), O_RDONLY|O_BINARY);
+    if (fd<0){
+        std::lock_guard<std::mutex> lock(output_mutex);
+        fprintf(stderr,"cannot open %s\n",t.path.c_str());
+        return;
+    }
+    uint64_t offset = t.offset;
+    uint64_t length = t.length;
+    if(length==0){                      /* as discovered */
+        offset = opt_omit ? block_size : 0;
+        length = UINT64_MAX;
+        struct stat st;
+        if(opt_blocks && fstat(fd,&st)==0 && S_ISREG(st.st_mode) && (uint64_t)st.st_size>offset+SPLIT_SIZE){
+            const uint64_t range = std::max<uint64_t>(SPLIT_SIZE/block_size,1)*block_size;
+            for(uint64_t off=offset;off<(uint64_t)st.st_size;off+=range){
+                file_scheduler::task sub(t.path,off,std::min<uint64_t>(range,st.st_size-off));
+                scheduler->spawn(worker,sub);
+            }
+            close(fd);
+            return;
+        }
+    }
+
+    scan_worker &w = scan_workers[worker];
+    std::vector<int> types(sceadan_nr_models(s));
+    std::string out,err;
+    ssize_t in_block = 0;
+    auto report = [&](uint64_t start,const int *block_types){
+        format_output(out,s,t.path.c_str(),start,block_types);
+        if(opt_preport){
+            char range[64];
+            snprintf(range,sizeof(range),"%" PRIu64 "-%" PRIu64 "\n",start,start+block_size);
+            err += range;
+        }
+    };
+    /* Classify n bytes that are at offset in the file */
+    auto feed = [&](const uint8_t *p,ssize_t left){
+        const uint8_t *base = p;
+        while(left>0){
+            const ssize_t n = opt_blocks ? std::min(left, block_size - in_block) : left;
+            sceadan_ctx_update(w.ctx,p,n);
+            p        += n;
+            left     -= n;
+            in_block += n;
+            if(opt_blocks && in_block==block_size){
+                sceadan_ctx_classify_all(w.ctx,&types[0]);
+                report(offset + (p - base) - block_size,&types[0]);
+                in_block = 0;
+            }
+        }
+    };
+    /* Holes are not read, and whole blocks of a hole are not classified;
+     * see process_file()
+     */
+    auto feed_hole = [&](uint64_t len){
+        while(len>0){
+            if(opt_blocks && in_block==0 && len>=(uint64_t)block_size){
+                if(w.zero_types.empty()){
+                    sceadan_ctx_update_zeros(w.ctx,block_size);
+                    w.zero_types.resize(types.size());
+                    sceadan_ctx_classify_all(w.ctx,&w.zero_types[0]);
+                }
+                report(offset,&w.zero_types[0]);
+                offset += block_size;
+                length -= block_size;
+                len    -= block_size;
+                continue;
+            }
+            const uint64_t n = opt_blocks ? std::min<uint64_t>(len,block_size-in_block) : len;
+            sceadan_ctx_update_zeros(w.ctx,n);
+            in_block += n;
+            if(opt_blocks && in_block==block_size){
+                sceadan_ctx_classify_all(w.ctx,&types[0]);
+                report(offset + n - block_size,&types[0]);
+                in_block = 0;
+            }
+            offset += n;
+            length -= n;
+            len    -= n;
+        }
+    };
+
+    struct stat st;
+    bool sparse = false;                /* holes can be found with SEEK_DATA/SEEK_HOLE */
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    sparse = fstat(fd,&st)==0 && S_ISREG(st.st_mode);
+#endif
+    while(length>0){
+        size_t want = std::min<uint64_t>(length,READ_CHUNK_SIZE);
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+        if(sparse){
+            if(offset>=(uint64_t)st.st_size) break;
+            off_t data = lseek(fd,offset,SEEK_DATA);
+            if(data<0 && errno==ENXIO) data = st.st_size;   /* a hole to the end */
+            off_t hole = (data>=0 && data<st.st_size) ? lseek(fd,data,SEEK_HOLE) : st.st_size;
+            if(data<0 || hole<0){
+                sparse = false;         /* the file system cannot tell; read the rest */
+            } else if((uint64_t)data>offset){
+                feed_hole(std::min<uint64_t>(std::min<uint64_t>(data,st.st_size)-offset,length));
+                continue;
+            } else {
+                want = std::min<uint64_t>(want,hole-offset);
+            }
+        }
+#endif
+#ifdef HAVE_PREAD
+        const ssize_t rd = pread(fd,w.buf,want,offset);
+#else
+        const ssize_t rd = (lseek(fd,offset,SEEK_SET)<0) ? -1 : read(fd,w.buf,want);
+#endif
+        if(rd<0){ perror("read"); break;}
+        if(rd==0) break;
+        feed(w.buf,rd);
+        offset += rd;
+        length -= rd;
+    }
+    if(!opt_blocks){
+        sceadan_ctx_classify_all(w.ctx,&types[0]);
+        format_output(out,s,t.path.c_str(),0,&types[0]);
+        if(opt_preport){
+            char range[64];
+            snprintf(range,sizeof(range),"%" PRIu64 "-%" PRIu64 "\n",offset,offset);
+            err += range;
+        }
+    }
+    sceadan_ctx_clear(w.ctx);           /* a final partial block */
+    close(fd);
+
+    std::lock_guard<std::mutex> lock(output_mutex);
+    fputs(out.c_str(),stdout);
+    fputs(err.c_str(),stderr);
+}
+
+
 static int alldigits(const char *str)
 {
     while(*str){
@@ -176,14 +665,32 @@ static int alldigits(const char *str)
     return 1;
 }
 
+/* The handle used for type lookups while the options are parsed.
+ * It is reopened only if -C changes the class file.
+ */
+static sceadan *types_handle()
+{
+    static sceadan *sc = 0;
+    static std::string class_file;
+    const std::string cf = opt_class_file ? opt_class_file : "";
+    if(sc && cf!=class_file){
+        sceadan_close(sc);
+        sc = 0;
+    }
+    if(sc==0){
+        sc = sceadan_open(0,opt_class_file,0);
+        class_file = cf;
+    }
+    return sc;
+}
+
 /* Return the type for a name, or -1 if there is no type */
 static int type_for_name(const char *name)
 {
     if (alldigits(name)) return atoi(name);
-    sceadan *sc = sceadan_open(0,opt_class_file,0);
+    sceadan *sc = types_handle();
     if(sc==0) return -1;                // no precompiled model
     int ival = sceadan_type_for_name(sc,name);
-    sceadan_close(sc);
     if(ival>0) return ival;
     fprintf(stderr,"%s: not a valid type name\n",name);
     exit(1);
@@ -192,11 +699,9 @@ static int type_for_name(const char *name)
 /* Return the name for a type, or 0 if there is no name */
 static const char *name_for_type(int n)
 {
-    sceadan *sc = sceadan_open(0,opt_class_file,0);
+    sceadan *sc = types_handle();
     if(sc==0) return 0;                 // no precompiled names
-    const char *ret = sceadan_name_for_type(sc,n);
-    sceadan_close(sc);
-    return ret;
+    return sceadan_name_for_type(sc,n);
 }
 
 void usage(void) __attribute__((noreturn));
@@ -209,19 +714,42 @@ void usage()
     printf("  -j <class>  - generate features for <class> and output in JSON format\n");
     printf("  -t <class>  - generate a liblinear training for class <class>\n");
     printf("  -P          - report the blocks and byte ranges sampled to stderr\n");
-    printf("  -s N        - specifies a random number generator seed.\n");
+    printf("  -r N        - specifies a random number generator seed (for -p).\n");
     printf("  -x          - omit file headers (the first block)\n");
     printf("  -n M        - ngram mode (0=disjoint, 1=overlapping, 2=even/odd)\n");
     printf("  -R n        - reduce feature by selecting top 'n' features based on feature weight.\n");
+    printf("  -S <statsfile> - with -t, append per-class feature statistics to statsfile;\n");
+    printf("                with -R, select the top 'n' features from statsfile instead (no model needed)\n");
+    printf("  -K <anova|chi2> - statistic used to rank features with -S -R (default anova)\n");
     printf("  -F <feature_mask_write_file> - feature mask file name for output.\n");
+    printf("  -B <bundlefile> - write the model, classes, feature mask and ngram mode as one\n");
+    printf("                binary bundle that can be used with -m\n");
 
     printf("\nfor classifying:\n");
     printf("  -m <modelfile>   - use modelfile instead of build-in model\n");
+    printf("  -p <N|N%%>        - classify N random blocks (or N percent of them) of each file and print\n");
+    printf("                     the share of each type with a 95%% confidence interval; also with -t\n");
+    printf("  -e               - whole-file mode: stop reading once the prediction is stable\n");
+    printf("                     (use -P to report the bytes read)\n");
+    printf("  -M <modelfile>[,classfile[,maskfile]] - also classify with this model (may be repeated);\n");
+    printf("                     features are extracted once and one type is printed per model\n");
     
     printf("\ngeneral:\n");
     printf("  -C classfile  - Specify a file of user-defined class types (one type per line)\n");
     printf("  -T [#|name|-] - If #, provide the sceadan type name; if name, provide the type number; if -, list\n");
+    printf("                  all types. Several # and names may be given separated by commas.\n");
     printf("  -b <size>   - specifies blocksize (default %zd) for block-by-block classification.\n",block_size);
+    printf("  -w N        - with -b, classify blocks on N threads; the output is the same\n");
+    printf("  -W N        - scan files on N threads that steal work from each other; with -b, files\n");
+    printf("                over %d MiB are split into ranges. The lines of a file (or range) stay\n",SPLIT_SIZE>>20);
+    printf("                together, but files finish in any order. Not with -D or -q\n");
+    printf("  -L N        - list directories on N threads; files are found (and with -W, scanned)\n");
+    printf("                in no particular order\n");
+    printf("  -O <inode|extent> - process files in batches of %d sorted by inode number, or by the\n",ORDER_BATCH);
+    printf("                disk address of their first extent (FIEMAP; else by inode), to cut seeks\n");
+    printf("  -D          - read files and devices with O_DIRECT, around the page cache\n");
+    printf("  -q depth[,buffers] - read files with io_uring, keeping depth reads of %d MiB in flight\n",READ_CHUNK_SIZE>>20);
+    printf("                and up to buffers (default depth) read ahead, e.g. -q 8,16\n");
     printf("  -f <feature_mask_read_file> - feature mask file name for input.\n");
     printf("  -h          - generate help (-hh for more)\n");
 
@@ -249,25 +777,134 @@ inline std::string safe_utf16to8(std::wstring st){ // needs to be cleaned up
     return utf8_line;
 }
 
+/* Scan a file on the -W threads or here */
+static void dispatch_file(const std::string &fname)
+{
+    if(opt_debug) fprintf(stderr,"process %s\n",fname.c_str());
+    if(scheduler){
+        file_scheduler::task task(fname,0,0);
+        scheduler->add(task);
+    } else {
+        process_file(fname.c_str());
+    }
+}
+
+/****
+ *** -O: physical order
+ ****/
+
+/* Files are read in the order of where they are on the device, as
+ * near as can be told, so that a spinning disk or an image of one is
+ * read mostly sequentially instead of in directory order.
+ */
+struct ordered_file {
+    uint64_t    physical;               /* of the first extent; 0 if unknown */
+    uint64_t    ino;
+    std::string path;
+    bool operator<(const ordered_file &o) const {
+        return physical<o.physical || (physical==o.physical && ino<o.ino);
+    }
+};
+static std::vector<ordered_file> order_batch;
+
+/* Disk address of the first extent of fd, or 0 */
+static uint64_t first_extent(int fd)
+{
+#if defined(HAVE_LINUX_FIEMAP_H) && defined(FS_IOC_FIEMAP)
+    uint64_t buf[(sizeof(struct fiemap)+sizeof(struct fiemap_extent))/sizeof(uint64_t)+1]; /* room for one extent */
+    struct fiemap *fm = (struct fiemap *)buf;
+    memset(buf,0,sizeof(buf));
+    fm->fm_length = FIEMAP_MAX_OFFSET;
+    fm->fm_extent_count = 1;
+    if(ioctl(fd,FS_IOC_FIEMAP,fm)==0 && fm->fm_mapped_extents>0 &&
+       (fm->fm_extents[0].fe_flags & FIEMAP_EXTENT_UNKNOWN)==0){
+        return fm->fm_extents[0].fe_physical;
+    }
+#else
+    (void)fd;
+#endif
+    return 0;
+}
+
+static void flush_order_batch()
+{
+    std::sort(order_batch.begin(),order_batch.end());
+    for(size_t i=0;i<order_batch.size();i++) dispatch_file(order_batch[i].path);
+    order_batch.clear();
+}
+
+/* A file from dig: with -O, hold it until the batch is sorted */
+static void found_file(const std::string &fname)
+{
+    if(opt_order==0){
+        dispatch_file(fname);
+        return;
+    }
+    ordered_file of = {0,0,fname};
+    struct stat st;
+    if(opt_order==ORDER_EXTENT){
+        int fd = open(fname.c_str(),O_RDONLY|O_BINARY);
+        if(fd>=0){
+            if(fstat(fd,&st)==0) of.ino = st.st_ino;
+            of.physical = first_extent(fd);
+            close(fd);
+        }
+    } else if(stat(fname.c_str(),&st)==0){
+        of.ino = st.st_ino;
+    }
+    order_batch.push_back(of);
+    if(order_batch.size()>=ORDER_BATCH) flush_order_batch();
+}
 
 int main (int argc, char *const argv[])
 {
     int ch;
-    int opt_ngram_mode = SCEADAN_NGRAM_MODE_DEFAULT;
+    int opt_ngram_mode = -1;            /* -1 keeps the mode from sceadan_open() (default or bundle) */
 
-    while((ch = getopt(argc,argv,"b:dC:ef:F:j:m:n:Pp:R:r:T:t:xh")) != -1){
+    while((ch = getopt(argc,argv,"B:b:dC:Def:F:j:K:L:m:M:n:O:Pp:q:R:r:S:T:t:w:W:xh")) != -1){
         switch(ch){
         case 'C': opt_class_file = optarg; break;
+        case 'B': opt_bundle_out = optarg; break;
         case 'b': block_size = atoi(optarg); opt_blocks = 1; break;
         case 'd': opt_debug++;break;
+        case 'D': opt_direct = 1; break;
+        case 'e': opt_early = 1; break;
         case 'f': feature_mask_file_in  = optarg; break;
         case 'F': feature_mask_file_out = optarg; break;
         case 'j': opt_json  = type_for_name(optarg); break;
+        case 'K':
+            if(strcmp(optarg,"chi2")==0) opt_select = SCEADAN_SELECT_CHI2;
+            else if(strcmp(optarg,"anova")==0) opt_select = SCEADAN_SELECT_ANOVA_F;
+            else usage();
+            break;
+        case 'L': opt_dig_threads = atoi(optarg); break;
         case 'm': opt_model = optarg; break;
+        case 'M': opt_extra_models.push_back(optarg); break;
+        case 'O':
+            if(strcmp(optarg,"inode")==0) opt_order = ORDER_INODE;
+            else if(strcmp(optarg,"extent")==0) opt_order = ORDER_EXTENT;
+            else usage();
+            break;
         case 'P': opt_preport = 1; break;
+        case 'p':
+            if(strchr(optarg,'%')) opt_sample_percent = atof(optarg);
+            else opt_sample_count = strtoull(optarg,0,10);
+            if(opt_sample_percent<=0 && opt_sample_count==0) usage();
+            break;
+        case 'q': {
+            unsigned depth = 0, buffers = 0;
+            if(sscanf(optarg,"%u,%u",&depth,&buffers)<1 || depth<1) usage();
+            delete ring;
+            ring = new ring_reader(depth,buffers ? buffers : depth,READ_CHUNK_SIZE);
+            if(!ring->ok()) fprintf(stderr,"io_uring is not available; files are read with read()\n");
+            break;
+        }
         case 'r': opt_seed = atoi(optarg);break; /* seed the random number generator */
         case 'R': opt_reduce = atoi(optarg); assert(opt_reduce>0); break;
+        case 'S': opt_stats = optarg; break;
         case 't': opt_train = type_for_name(optarg); break;
+        case 'w': opt_threads = atoi(optarg); break;
+        case 'W': opt_scan_threads = atoi(optarg); break;
         case 'x': opt_omit = 1; break;
         case 'h': opt_help++; break;
         case 'n': opt_ngram_mode = atoi(optarg);break;
@@ -279,12 +916,15 @@ int main (int argc, char *const argv[])
                     printf("%d\t%s\n",i,name);
                 }
             }
-            if(alldigits(optarg)){
-                const char *name = name_for_type(atoi(optarg));
-                if(name==0) fprintf(stderr,"%s: invalid number\n",optarg);
-                else printf("%s\n",name);
-            } else {
-                printf("%d\n",type_for_name(optarg));
+            /* one answer per line for each comma-separated # or name */
+            for(char *item = strtok(optarg,","); item; item = strtok(0,",")){
+                if(alldigits(item)){
+                    const char *name = name_for_type(atoi(item));
+                    if(name==0) fprintf(stderr,"%s: invalid number\n",item);
+                    else printf("%s\n",name);
+                } else {
+                    printf("%d\n",type_for_name(item));
+                }
             }
             exit(0);
         }
@@ -302,6 +942,7 @@ int main (int argc, char *const argv[])
     if(opt_debug) fprintf(stderr,"Calling sceadan_open\n");
 
     s = sceadan_open(opt_model, opt_class_file, feature_mask_file_in);
+    zero_types.clear();                 /* they belong to s */
 
     if(!s){
         fprintf(stderr,"sceadan_open failed.\n");
@@ -309,17 +950,73 @@ int main (int argc, char *const argv[])
         exit(1);
     }
 
+    for(size_t i=0;i<opt_extra_models.size();i++){
+        /* split model[,classfile[,maskfile]] */
+        std::string fields[3];
+        std::string spec = opt_extra_models[i];
+        for(int f=0;f<3;f++){
+            size_t comma = (f<2) ? spec.find(',') : std::string::npos;
+            fields[f] = spec.substr(0,comma);
+            if(comma==std::string::npos) break;
+            spec = spec.substr(comma+1);
+        }
+        if(sceadan_add_model(s,fields[0].c_str(),fields[1].c_str(),fields[2].c_str())<0){
+            fprintf(stderr,"cannot add model %s\n",fields[0].c_str());
+            exit(1);
+        }
+    }
+
     if(opt_debug) fprintf(stderr,"back; setting ngram mode\n");
-    sceadan_set_ngram_mode(s,opt_ngram_mode);
+    if(opt_ngram_mode>=0) sceadan_set_ngram_mode(s,opt_ngram_mode);
     if(opt_debug) fprintf(stderr,"back\n");
 
     if (opt_reduce!=0){
         // feature reducetion generate new feature_mask file 
         assert(feature_mask_file_out!=0);
-        int ret = sceadan_reduce_feature(s, feature_mask_file_out, opt_reduce);
+        int ret = opt_stats ? sceadan_select_features(s, opt_stats, feature_mask_file_out, opt_reduce, opt_select)
+                            : sceadan_reduce_feature(s, feature_mask_file_out, opt_reduce);
         exit(ret);
     }
 
+    if (opt_bundle_out){
+        exit(sceadan_save_bundle(s, opt_bundle_out) < 0 ? 1 : 0);
+    }
+
+    if(opt_stats){
+        if(!opt_train){
+            fprintf(stderr,"-S requires -t or -R\n");
+            exit(1);
+        }
+        sceadan_stats_on_classify(s,opt_train);
+    }
+
+    /* Classifying blocks, -w runs a reader, workers and an ordered writer */
+    if(opt_threads>0 && opt_scan_threads==0 && opt_blocks && !opt_train && !opt_json &&
+       opt_sample_count==0 && opt_sample_percent<=0){
+        pipeline = new block_pipeline(s,opt_threads,block_size,
+                                      [](const std::string &path,uint64_t offset,const int *types){
+                                          do_output(s,path.c_str(),offset,types);
+                                          if(opt_preport) fprintf(stderr,"%" PRIu64 "-%" PRIu64 "\n",offset,offset+block_size);
+                                      });
+    }
+
+    /* -W scans files on threads while dig finds more. The workers read
+     * with pread, so the readers of -D and -q are not used.
+     */
+    if(opt_scan_threads>0 && (opt_direct || ring)){
+        fprintf(stderr,"-W cannot be used with -D or -q\n");
+        exit(1);
+    }
+    if(opt_scan_threads>0 && !opt_train && !opt_json && !opt_early &&
+       opt_sample_count==0 && opt_sample_percent<=0){
+        for(int i=0;i<opt_scan_threads;i++){
+            scan_worker w = {sceadan_ctx_open(s),(uint8_t *)malloc(READ_CHUNK_SIZE),std::vector<int>()};
+            if(w.buf==0){ perror("malloc"); exit(1); }
+            scan_workers.push_back(w);
+        }
+        scheduler = new file_scheduler(opt_scan_threads,scan_task);
+    }
+
     if(argc < 1) usage();
     if(strcmp(argv[0],"-")==0){         /* process stdin */
         process_file("-");    
@@ -327,18 +1024,30 @@ int main (int argc, char *const argv[])
 
     while(argc>0){
         if(opt_debug) fprintf(stderr,"dig(%s)\n",*argv);
+#ifndef WIN32
+        if(opt_dig_threads>0){
+            parallel_dig pd(*argv,opt_dig_threads);
+            std::string fname;
+            while(pd.next(fname)) found_file(fname);
+            argc--;
+            argv++;
+            continue;
+        }
+#endif
         dig d(*argv);
         for(dig::const_iterator it = d.begin();it!=d.end();++it){
 #ifdef WIN32
-            std::string fname = safe_utf16to8(*it);
+            found_file(safe_utf16to8(*it));
 #else
-            std::string fname = *it;
+            found_file(*it);
 #endif
-            if(opt_debug) fprintf(stderr,"process %s\n",fname.c_str());
-            process_file(fname.c_str());
         }
         argc--;
         argv++;
     }
+    flush_order_batch();
+    if(pipeline) pipeline->finish();
+    if(scheduler) scheduler->finish();
+    if(opt_stats && sceadan_save_stats(s,opt_stats)<0) exit(1);
     exit(0);
 }
@@ -32,13 +32,20 @@
 #include "sceadan.h"
 
 /*
- * Compile a liblinear model to C
+ * Compile a liblinear model to C, or with -b to a binary blob that is
+ * linked into the program without being compiled.
  */
 
 int main(int argc,char **argv)
 {
+    int binary = 0;
+    if(argc==4 && strcmp(argv[1],"-b")==0){
+        binary = 1;
+        argc--;
+        argv++;
+    }
     if(argc!=3){
-        fprintf(stderr,"usage: mcompile <modelfile> <outputfile>\n");
+        fprintf(stderr,"usage: mcompile [-b] <modelfile> <outputfile>\n");
         exit(1);
     }
     fprintf(stderr,"Loading %s\n",argv[1]);
@@ -47,8 +54,19 @@ int main(int argc,char **argv)
         perror(argv[1]);
         exit(1);
     }
-    FILE *f = fopen(argv[2],"w");
-    sceadan_model_dump(model,f);
+    FILE *f = fopen(argv[2],binary ? "wb" : "w");
+    if(!f){
+        perror(argv[2]);
+        exit(1);
+    }
+    if(binary){
+        if(sceadan_model_save_blob(model,f)<0){
+            fprintf(stderr,"%s: write error\n",argv[2]);
+            exit(1);
+        }
+    } else {
+        sceadan_model_dump(model,f);
+    }
     fclose(f);
     return(0);
 }
@@ -0,0 +1,101 @@
+//===============================================================================================================//
+
+//Copyright (c) 2012-2013 The University of Texas at San Antonio
+
+//This program is free software; you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation; either version 2 of the License, or (at your option) any later version.
+
+//This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Public License for more details.
+
+//You should have received a copy of the GNU General Public License along with this program; if not, write to the Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+//Written by: 
+//Dr. Nicole Beebe and Lishu Liu, Department of Information Systems and Cyber Security (nicole.beebe@utsa.edu)
+//Laurence Maddox, Department of Computer Science
+//University of Texas at San Antonio
+//One UTSA Circle 
+//San Antonio, Texas 78209
+
+//===============================================================================================================//
+
+
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../liblinear/linear.h"
+#include "sceadan.h"
+
+/*
+ * Update a liblinear model with newly labeled vectors, as written by
+ * sceadan_app -t, without retraining from scratch. New types become
+ * new classes; give them names with a class file (sceadan_app -C).
+ */
+
+void usage(void) __attribute__((noreturn));
+void usage()
+{
+    fprintf(stderr,"usage: mupdate [options] <modelfile> <vectorfile> <outputfile>\n");
+    fprintf(stderr,"  -c C   - largest step for one vector (default 1)\n");
+    fprintf(stderr,"  -i N   - passes over vectorfile (default 1; vectorfile '-' is read once)\n");
+    fprintf(stderr,"  -A     - do not average the weights over the updates\n");
+    exit(1);
+}
+
+int main(int argc,char **argv)
+{
+    double C = 1;
+    int passes = 1;
+    int average = 1;
+    int ch;
+    while((ch = getopt(argc,argv,"Ac:i:h")) != -1){
+        switch(ch){
+        case 'A': average = 0; break;
+        case 'c': C = atof(optarg); break;
+        case 'i': passes = atoi(optarg); break;
+        default: usage();
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if(argc!=3 || C<=0 || passes<1) usage();
+
+    struct model *model = load_model(argv[0]);
+    if(!model){
+        perror(argv[0]);
+        exit(1);
+    }
+    FILE *f = strcmp(argv[1],"-")==0 ? stdin : fopen(argv[1],"r");
+    if(!f){
+        perror(argv[1]);
+        exit(1);
+    }
+    int nr_class = model->nr_class;
+    for(int i=0;i<passes;i++){
+        if(i>0){
+            if(f==stdin) break;
+            rewind(f);
+        }
+        uint64_t nr_vectors = 0, nr_mistakes = 0;
+        struct model *updated = sceadan_model_update(model,f,C,average,&nr_vectors,&nr_mistakes);
+        if(!updated) exit(1);
+        free_and_destroy_model(&model);
+        model = updated;
+        fprintf(stderr,"pass %d: %" PRIu64 " vectors, %" PRIu64 " mistakes\n",i+1,nr_vectors,nr_mistakes);
+    }
+    if(model->nr_class>nr_class){
+        fprintf(stderr,"added %d classes\n",model->nr_class-nr_class);
+    }
+    if(save_model(argv[2],model)){
+        fprintf(stderr,"%s: write error\n",argv[2]);
+        exit(1);
+    }
+    free_and_destroy_model(&model);
+    if(f!=stdin) fclose(f);
+    return(0);
+}
@@ -0,0 +1,244 @@
+/*
+ * ring_reader.cpp:
+ * io_uring reads through the raw system calls, so that liburing is not
+ * needed. Without <linux/io_uring.h> the reader is never ok() and the
+ * caller reads the file itself.
+ */
+
+#include "config.h"
+#include "ring_reader.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#define RING_ALIGN 4096                 /* buffers are page aligned */
+
+struct ring_reader::slot {
+    uint8_t  *buf;
+    struct iovec iov;                   /* of the read in flight; the kernel may read it late */
+    int      fd;
+    uint64_t offset;                    /* of buf[0] in the file */
+    size_t   want;                      /* bytes to read into buf */
+    size_t   got;                       /* bytes read into buf */
+    int      error;                     /* errno of a failed read */
+    bool     busy;                      /* a read is in flight */
+    bool     eof;                       /* a read returned 0 */
+};
+
+ring_reader::ring_reader(unsigned depth_,unsigned buffers,size_t buffer_size_):
+    ring_fd(-1),buffer_size(buffer_size_),align(1),depth(depth_),nr_slots(0),slots(0),queued(0),reading(0),
+    sq_ptr(MAP_FAILED),cq_ptr(MAP_FAILED),sqes_ptr(MAP_FAILED),sq_size(0),cq_size(0),sqes_size(0),
+    sq_head(0),sq_tail(0),sq_mask(0),sq_array(0),cq_head(0),cq_tail(0),cq_mask(0),cqes(0)
+{
+    if(depth<1) depth = 1;
+    if(buffers<1) buffers = 1;
+
+    struct io_uring_params p;
+    memset(&p,0,sizeof(p));
+    int fd = syscall(__NR_io_uring_setup,depth,&p);
+    if(fd<0) return;
+
+    sq_size   = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+    cq_size   = p.cq_off.cqes  + p.cq_entries*sizeof(struct io_uring_cqe);
+    sqes_size = p.sq_entries*sizeof(struct io_uring_sqe);
+    if(p.features & IORING_FEAT_SINGLE_MMAP){
+        if(cq_size>sq_size) sq_size = cq_size;
+        cq_size = 0;
+    }
+    sq_ptr = mmap(0,sq_size,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,fd,IORING_OFF_SQ_RING);
+    cq_ptr = cq_size ? mmap(0,cq_size,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,fd,IORING_OFF_CQ_RING) : sq_ptr;
+    sqes_ptr = mmap(0,sqes_size,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,fd,IORING_OFF_SQES);
+    if(sq_ptr==MAP_FAILED || cq_ptr==MAP_FAILED || sqes_ptr==MAP_FAILED){
+        close(fd);
+        return;
+    }
+    uint8_t *sq = (uint8_t *)sq_ptr;
+    uint8_t *cq = (uint8_t *)cq_ptr;
+    sq_head  = (unsigned *)(sq + p.sq_off.head);
+    sq_tail  = (unsigned *)(sq + p.sq_off.tail);
+    sq_mask  = (unsigned *)(sq + p.sq_off.ring_mask);
+    sq_array = (unsigned *)(sq + p.sq_off.array);
+    cq_head  = (unsigned *)(cq + p.cq_off.head);
+    cq_tail  = (unsigned *)(cq + p.cq_off.tail);
+    cq_mask  = (unsigned *)(cq + p.cq_off.ring_mask);
+    cqes     = cq + p.cq_off.cqes;
+
+    slots = new slot[buffers];
+    for(nr_slots=0;nr_slots<buffers;nr_slots++){
+        slot &sl = slots[nr_slots];
+        memset(&sl,0,sizeof(sl));
+        if(posix_memalign((void **)&sl.buf,RING_ALIGN,buffer_size)!=0) break;
+    }
+    if(nr_slots<buffers){
+        close(fd);
+        return;
+    }
+    if(depth>p.sq_entries) depth = p.sq_entries;
+    ring_fd = fd;
+}
+
+ring_reader::~ring_reader()
+{
+    for(unsigned i=0;i<nr_slots;i++) free(slots[i].buf);
+    delete [] slots;
+    if(sqes_ptr!=MAP_FAILED) munmap(sqes_ptr,sqes_size);
+    if(cq_ptr!=MAP_FAILED && cq_ptr!=sq_ptr) munmap(cq_ptr,cq_size);
+    if(sq_ptr!=MAP_FAILED) munmap(sq_ptr,sq_size);
+    if(ring_fd>=0) close(ring_fd);
+}
+
+/* Put a read of the rest of the slot's buffer on the submission queue */
+void ring_reader::queue(slot *sl)
+{
+    const unsigned tail = *sq_tail;
+    const unsigned idx  = tail & *sq_mask;
+    struct io_uring_sqe *sqe = (struct io_uring_sqe *)sqes_ptr + idx;
+    memset(sqe,0,sizeof(*sqe));
+    sl->iov.iov_base = sl->buf + sl->got;
+    sl->iov.iov_len  = sl->want - sl->got;
+    sqe->opcode    = IORING_OP_READV;
+    sqe->fd        = sl->fd;
+    sqe->addr      = (uint64_t)(uintptr_t)&sl->iov;
+    sqe->len       = 1;
+    sqe->off       = sl->offset + sl->got;
+    sqe->user_data = (uint64_t)(uintptr_t)sl;
+    sq_array[idx]  = idx;
+    __atomic_store_n(sq_tail,tail+1,__ATOMIC_RELEASE);
+    sl->busy = true;
+    queued++;
+    reading++;
+}
+
+/* Submit what is queued and wait for min_complete completions */
+int ring_reader::enter(unsigned min_complete)
+{
+    while(true){
+        int ret = syscall(__NR_io_uring_enter,ring_fd,queued,min_complete,
+                          min_complete ? IORING_ENTER_GETEVENTS : 0,(void *)0,0);
+        if(ret<0 && errno==EINTR) continue;
+        if(ret<0) return -1;
+        queued -= ret;
+        return 0;
+    }
+}
+
+/* Take the completions off the queue. A short read is continued
+ * where it stopped, so a slot is done when it is full, at the end of
+ * the file, or failed.
+ */
+void ring_reader::reap()
+{
+    unsigned head = *cq_head;
+    while(head!=__atomic_load_n(cq_tail,__ATOMIC_ACQUIRE)){
+        const struct io_uring_cqe *cqe = (const struct io_uring_cqe *)cqes + (head & *cq_mask);
+        slot *sl = (slot *)(uintptr_t)cqe->user_data;
+        const int res = cqe->res;
+        head++;
+        sl->busy = false;
+        reading--;
+        if(res==-EAGAIN || res==-EINTR){
+            queue(sl);
+        } else if(res<0){
+            sl->error = -res;
+        } else if(res==0){
+            sl->eof = true;
+        } else {
+            sl->got += res;
+            if(sl->got<sl->want){
+                if(sl->got % align==0) queue(sl);
+                else sl->eof = true;
+            }
+        }
+    }
+    __atomic_store_n(cq_head,head,__ATOMIC_RELEASE);
+}
+
+int ring_reader::read_fd(int fd,uint64_t offset,const consumer &consume,size_t align_,uint64_t length)
+{
+    align = align_ ? align_ : 1;
+    uint64_t next_offset = offset;
+    const uint64_t end   = (length>UINT64_MAX-offset) ? UINT64_MAX : offset+length;
+    unsigned next_read = 0;             /* slot for the next read */
+    unsigned next_use  = 0;             /* slot the consumer wants next */
+    unsigned busy      = 0;             /* slots read or being read for the consumer */
+    bool     at_end    = false;
+    int      error     = 0;
+
+    while(true){
+        /* Keep the reads in flight until the end of the file is seen */
+        while(!at_end && !error && busy<nr_slots && reading<depth && next_offset<end){
+            slot *sl = &slots[next_read];
+            sl->fd     = fd;
+            sl->offset = next_offset;
+            sl->want   = std::min<uint64_t>(buffer_size,end-next_offset);
+            sl->want   = std::min<uint64_t>(buffer_size,(sl->want+align-1)/align*align);
+            sl->got    = 0;
+            sl->error  = 0;
+            sl->eof    = false;
+            queue(sl);
+            next_offset += sl->want;
+            next_read = (next_read+1) % nr_slots;
+            busy++;
+        }
+        if(busy==0) break;
+
+        /* Wait for the slot the consumer needs */
+        slot *sl = &slots[next_use];
+        if(enter(sl->busy ? 1 : 0)<0){
+            /* Reads may still be in flight into the buffers. Closing the
+             * ring waits for them; later files are read without it.
+             */
+            error = errno;
+            close(ring_fd);
+            ring_fd = -1;
+            break;
+        }
+        reap();
+        if(sl->busy) continue;
+        next_use = (next_use+1) % nr_slots;
+        busy--;
+        if(at_end || error) continue;   /* draining reads past the end */
+        if(sl->error){
+            error = sl->error;
+            continue;
+        }
+        if(sl->got>0) consume(sl->buf,std::min<uint64_t>(sl->got,end-sl->offset));
+        if(sl->got<sl->want || sl->offset+sl->got>=end) at_end = true;
+    }
+
+    if(error){
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+#else
+
+ring_reader::ring_reader(unsigned depth_,unsigned,size_t buffer_size_):
+    ring_fd(-1),buffer_size(buffer_size_),align(1),depth(depth_),nr_slots(0),slots(0),queued(0),reading(0),
+    sq_ptr(0),cq_ptr(0),sqes_ptr(0),sq_size(0),cq_size(0),sqes_size(0),
+    sq_head(0),sq_tail(0),sq_mask(0),sq_array(0),cq_head(0),cq_tail(0),cq_mask(0),cqes(0)
+{
+}
+
+ring_reader::~ring_reader()
+{
+}
+
+int ring_reader::read_fd(int,uint64_t,const consumer &,size_t,uint64_t)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+#endif
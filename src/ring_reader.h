@@ -0,0 +1,63 @@
+/*
+ * ring_reader.h:
+ * read files with io_uring, keeping several large reads in flight, and
+ * hand the data back in file order.
+ */
+
+#ifndef RING_READER_H
+#define RING_READER_H
+
+#include <functional>
+#include <stddef.h>
+#include <stdint.h>
+
+class ring_reader {
+public:
+    typedef std::function<void(const uint8_t *buf,size_t len)> consumer;
+
+    /* Up to depth reads of buffer_size bytes are kept in flight.
+     * Buffers that have been read wait in file order for the consumer,
+     * so reading can run ahead of it by up to buffers buffers.
+     */
+    ring_reader(unsigned depth,unsigned buffers,size_t buffer_size);
+    ~ring_reader();
+
+    /* False if io_uring is not available; read() the file instead */
+    bool ok() const { return ring_fd>=0; }
+
+    /* Read fd from offset to its end, or for length bytes, and call
+     * consume with the data in order. Works for regular files and block
+     * devices. For an O_DIRECT fd, align is its logical block size: a
+     * read that stops off a block boundary has reached the end, and
+     * length is rounded up to it.
+     * Returns 0, or -1 with errno set.
+     */
+    int read_fd(int fd,uint64_t offset,const consumer &consume,size_t align=1,uint64_t length=UINT64_MAX);
+
+private:
+    ring_reader(const ring_reader &);
+    ring_reader &operator=(const ring_reader &);
+
+    struct slot;
+    void queue(slot *sl);
+    int  enter(unsigned min_complete);
+    void reap();
+
+    int      ring_fd;
+    size_t   buffer_size;
+    size_t   align;                     /* of the reads of the current file */
+    unsigned depth;
+    unsigned nr_slots;
+    slot     *slots;
+    unsigned queued;                    /* SQEs not yet passed to the kernel */
+    unsigned reading;                   /* reads in flight */
+
+    /* the rings shared with the kernel */
+    void     *sq_ptr,*cq_ptr,*sqes_ptr;
+    size_t   sq_size,cq_size,sqes_size;
+    unsigned *sq_head,*sq_tail,*sq_mask,*sq_array;
+    unsigned *cq_head,*cq_tail,*cq_mask;
+    void     *cqes;
+};
+
+#endif
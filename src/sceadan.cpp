@@ -51,6 +51,14 @@
 #include <stdlib.h>
 #include <math.h>
 #include <stdint.h>
+#include <inttypes.h>
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_SYS_FILE_H
+#include <sys/file.h>
+#endif
 
 #ifndef O_BINARY
 #define O_BINARY 0
@@ -58,15 +66,63 @@
 
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <set>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <cmath>
 
 /* We require liblinear. But we now use a built-in version
  */
 
 #include "../liblinear/linear.h"
 
+/* Type names by liblinear class, and an index from name to class.
+ * Names are interned or static, so they outlive the table.
+ */
+struct type_table {
+    type_table():names(),index(){}
+    std::vector<const char *> names;
+    std::unordered_map<std::string,int> index;
+    void add(const char *name){         // only if not present
+        if(index.insert(std::make_pair(std::string(name),int(names.size()))).second){
+            names.push_back(name);
+        }
+    }
+};
+
+/* A model together with its class map and feature mask.
+ *
+ * A handle classifies with one or more of these. Once the handle is
+ * in use they are read-only: sceadan_reload() replaces a classifier
+ * instead of changing it, and frees the old one after the
+ * classifications that were using it have finished.
+ */
+struct sceadan_classifier {
+private:
+    sceadan_classifier(const sceadan_classifier &i);
+    sceadan_classifier &operator=(const sceadan_classifier &i);
+public:
+    sceadan_classifier():model(),model_name(),entry(),types(),own_types(),ngram_mode(),mask_file(),mask(),own_mask(){}
+    const struct model *model;          // liblinear model
+    const char *model_name;             // interned in sceadan_t::name_pool
+    struct model_entry *entry;          // shared registry entry holding model; 0 if precompiled
+    const type_table *types;            // the shared default table, or own_types
+    type_table *own_types;              // if there is a class file or bundle
+
+    // For disabling individual features:
+    int ngram_mode;                     // 
+    const char *mask_file;              // feature mask file, if the mask was not built from ngram_mode
+    const char *mask;                   // feature mask: shared per ngram_mode, in a bundle, or own_mask
+    char *own_mask;                     // if loaded from a file or reduced
+};
+
 /* The definitions of the sceadan structure.  A pointer to the
  * structure is available for the calling C/C++ program, but the
  * contents are private. */
@@ -78,24 +134,80 @@ private:
     sceadan_t(const sceadan_t &i);
     sceadan_t &operator=(const sceadan_t &i);
 public:
-    sceadan_t():model(),model_name(),v(),types(),ngram_mode(),mask_file(),mask(),dump_json(),dump_nodes(),file_type(){}
-    const struct model *model;          // liblinear model
-    std::string model_name;
-    struct sceadan_vectors *v;          // internal used by sceadan
-    typedef std::map<std::string, int>  typemap_t;
-    typedef std::pair<std::string,int>  types_pair;
-    typemap_t types;                    // maps type names to liblinear class
-
-    // For disabling individual features:
-    int ngram_mode;                     // 
-    const char *mask_file;              // feature mask file (not clear why it needs to be here)
-    char *mask;                         // feature mask
+    sceadan_t():models(),name_pool(),rcu_epoch(0),rcu_writer(),ctx(){
+        rcu_readers[0] = 0;
+        rcu_readers[1] = 0;
+    }
+    // models[0] is the primary model. Additional models are evaluated
+    // against the same vectors, which hold the bigrams of every model's
+    // ngram_mode; each model builds its nodes with its own mode and mask.
+    // The pointers are only read through a classifier_guard.
+    std::deque<std::atomic<sceadan_classifier *> > models;
+    std::set<std::string> name_pool;    // type and model names; never shrinks, so pointers stay valid
+
+    // Read-copy-update state for models (see classifier_guard)
+    mutable std::atomic<unsigned> rcu_epoch;
+    mutable std::atomic<int> rcu_readers[2];
+    std::mutex rcu_writer;              // serializes sceadan_reload()
+
+    // Used by sceadan_update(), sceadan_classify() and the dump and
+    // statistics settings. The functions that classify through a const
+    // handle predict with a context of their own, which has none of
+    // those settings, so that they can be called from several threads.
+    struct sceadan_ctx_t *ctx;
+};
 
+/* The streaming state of one classification. It refers to a handle
+ * and only reads it, so each thread can classify with its own context
+ * against one shared handle.
+ */
+struct sceadan_ctx_t {
+private:
+    sceadan_ctx_t(const sceadan_ctx_t &i);
+    sceadan_ctx_t &operator=(const sceadan_ctx_t &i);
+public:
+    sceadan_ctx_t(const sceadan *s_):s(s_),v(),dump_json(),dump_nodes(),file_type(),stats(),stats_type(){}
+    const sceadan *s;
+    struct sceadan_vectors *v;          // the vectors being accumulated
 
     // These are set if the feature vectors are dumped:
     FILE *dump_json; // file where the feature vectors should be dumped as a JSON object
     FILE *dump_nodes; // file where the feature vector nodes should be dumped
     int file_type;                    // when dumping
+
+    // Set if feature statistics are accumulated (see sceadan_stats_on_classify)
+    struct feature_stats *stats;
+    int stats_type;
+};
+
+/* Holds the classifiers of a handle for the duration of one operation.
+ *
+ * Readers never block. They count themselves in the current epoch
+ * before they load the classifier pointers. sceadan_reload() publishes
+ * the new classifier, advances the epoch, and waits for the readers of
+ * the old epoch to leave before it frees the classifier it replaced.
+ */
+class classifier_guard {
+private:
+    classifier_guard(const classifier_guard &);
+    classifier_guard &operator=(const classifier_guard &);
+    const sceadan *s;
+    unsigned slot;
+public:
+    classifier_guard(const sceadan *s_):s(s_),slot(0){
+        while(true){
+            const unsigned e = s->rcu_epoch.load();
+            s->rcu_readers[e&1]++;
+            if(s->rcu_epoch.load()==e){
+                slot = e&1;
+                return;
+            }
+            s->rcu_readers[e&1]--;      // a reload started; count ourselves in the new epoch
+        }
+    }
+    ~classifier_guard(){ s->rcu_readers[slot]--; }
+    const sceadan_classifier *operator[](size_t i) const { return s->models[i].load(); }
+    size_t size() const { return s->models.size(); }
 };
 
 
@@ -284,19 +396,40 @@ static const char *sceadan_map_default[] =
  "DLL", "ELF", "BMP", "AES", "RAND",  "PPS", "RAR", "3GP", "7Z", 
  0};
 
+/* The table for classifiers with neither a class file nor bundle types */
+static const type_table *default_types()
+{
+    static const type_table *table = 0;
+    static std::once_flag once;
+    std::call_once(once,[]{
+            type_table *t = new type_table();
+            for(int i=0;sceadan_map_default[i];i++) t->add(sceadan_map_default[i]);
+            table = t;
+        });
+    return table;
+}
+
+const char *sceadan_name_for_model_type(const sceadan *s,int model,int code)
+{
+    classifier_guard g(s);
+    if(model<0 || model>=(int)g.size()) return 0;
+    const sceadan_classifier *c = g[model];
+    if(code<0 || code>=(int)c->types->names.size()) return 0;
+    return c->types->names[code];       // interned or static, so it outlives the classifier
+}
+
 const char *sceadan_name_for_type(const sceadan *s,int code)
 {
-    for (sceadan_t::typemap_t::const_iterator it = s->types.begin(); it!=s->types.end(); it++){
-        if( (*it).second == code) return (*it).first.c_str();
-    }
-    return(0);
+    return sceadan_name_for_model_type(s,0,code);
 }
 
 int sceadan_type_for_name(const sceadan *s,const char *name)
 {
-    sceadan_t::typemap_t::const_iterator it = s->types.find(name);
+    classifier_guard g(s);
+    const sceadan_classifier *c = g[0];
+    std::unordered_map<std::string,int>::const_iterator it = c->types->index.find(name);
 
-    if (it == s->types.end()) return -1;
+    if (it == c->types->index.end()) return -1;
     return (*it).second;
 }
 
@@ -309,9 +442,9 @@ int sceadan_type_for_name(const sceadan *s,const char *name)
 
 #define assert_and_set(i)    {assert(set[i]==0);set[i]=1;} // make sure it hasn't been set before
 #define set_index_value(k,v) {assert(idx<MAX_NR_ATTR);x[idx].index = k; x[idx].value = v; idx++;}
-#define feature_enabled(k)   s->mask[k]=='1'
+#define feature_enabled(k)   c->mask[k]=='1'
 
-static void build_nodes_from_vectors(const sceadan *s, const sceadan_vectors_t *v, struct feature_node *x )
+static void build_nodes_from_vectors(const sceadan_classifier *c, const sceadan_vectors_t *v, struct feature_node *x )
 {
     int idx = 0;                        /* cannot exceed MAX_NR_ATTR */
     int key = 0;
@@ -327,7 +460,7 @@ static void build_nodes_from_vectors(const sceadan *s, const sceadan_vectors_t *
     }
     
     /* Add the bigrams to the vector */
-    if (s->ngram_mode & 1) {
+    if (c->ngram_mode & 1) {
         for (int i = 0; i < NUNIGRAMS; i++) {
             for (int j = 0; j < NUNIGRAMS; j++) {
                 key = START_BIGRAMS_ALL+bigramcode(i,j);
@@ -337,7 +470,7 @@ static void build_nodes_from_vectors(const sceadan *s, const sceadan_vectors_t *
             }
         }
     }
-    if (s->ngram_mode & 2) {
+    if (c->ngram_mode & 2) {
         for (int i = 0; i < NUNIGRAMS; i++) {
             for (int j = 0; j < NUNIGRAMS; j++) {
                 key = START_BIGRAMS_EVEN+bigramcode(i,j);
@@ -347,7 +480,7 @@ static void build_nodes_from_vectors(const sceadan *s, const sceadan_vectors_t *
             }
         }
     }
-    if (s->ngram_mode & 4) {
+    if (c->ngram_mode & 4) {
         for (int i = 0; i < NUNIGRAMS; i++) {
             for (int j = 0; j < NUNIGRAMS; j++) {
                 key = START_BIGRAMS_ODD+bigramcode(i,j);
@@ -359,41 +492,41 @@ static void build_nodes_from_vectors(const sceadan *s, const sceadan_vectors_t *
     }
     
     key = STATS_IDX_BIGRAM_ENTROPY;
-    if (s->ngram_mode & 0x00008 && feature_enabled(key)) { set_index_value(key, v->mfv.bigram_entropy); }
+    if (c->ngram_mode & 0x00008 && feature_enabled(key)) { set_index_value(key, v->mfv.bigram_entropy); }
     key = STATS_IDX_ITEM_ENTROPY;
-    if (s->ngram_mode & 0x00010 && feature_enabled(key)) { set_index_value(key, v->mfv.item_entropy); }
+    if (c->ngram_mode & 0x00010 && feature_enabled(key)) { set_index_value(key, v->mfv.item_entropy); }
     key = STATS_IDX_HAMMING_WEIGHT; 
-    if (s->ngram_mode & 0x00020 && feature_enabled(key)) { set_index_value(key, v->mfv.hamming_weight.avg); }
+    if (c->ngram_mode & 0x00020 && feature_enabled(key)) { set_index_value(key, v->mfv.hamming_weight.avg); }
     key = STATS_IDX_MEAN_BYTE_VALUE;
-    if (s->ngram_mode & 0x00040 && feature_enabled(key)) { set_index_value(key, v->mfv.mean_byte_value.avg); }
+    if (c->ngram_mode & 0x00040 && feature_enabled(key)) { set_index_value(key, v->mfv.mean_byte_value.avg); }
     key = STATS_IDX_STDDEV_BYTE_VAL;
-    if (s->ngram_mode & 0x00080 && feature_enabled(key)) { set_index_value(key, v->mfv.stddev_byte_val.avg); }
+    if (c->ngram_mode & 0x00080 && feature_enabled(key)) { set_index_value(key, v->mfv.stddev_byte_val.avg); }
     key = STATS_IDX_ABS_DEV;
-    if (s->ngram_mode & 0x00100 && feature_enabled(key)) { set_index_value(key, v->mfv.abs_dev); }
+    if (c->ngram_mode & 0x00100 && feature_enabled(key)) { set_index_value(key, v->mfv.abs_dev); }
     key = STATS_IDX_SKEWNESS;
-    if (s->ngram_mode & 0x00200 && feature_enabled(key)) { set_index_value(key, v->mfv.skewness); }
+    if (c->ngram_mode & 0x00200 && feature_enabled(key)) { set_index_value(key, v->mfv.skewness); }
     key = STATS_IDX_KURTOSIS;
-    if (s->ngram_mode & 0x00400 && feature_enabled(key)) { set_index_value(key, v->mfv.kurtosis); }
+    if (c->ngram_mode & 0x00400 && feature_enabled(key)) { set_index_value(key, v->mfv.kurtosis); }
     key = STATS_IDX_CONTIGUITY;
-    if (s->ngram_mode & 0x00800 && feature_enabled(key)) { set_index_value(key, v->mfv.max_byte_streak.avg); }
+    if (c->ngram_mode & 0x00800 && feature_enabled(key)) { set_index_value(key, v->mfv.max_byte_streak.avg); }
     key = STATS_IDX_MAX_BYTE_STREAK;
-    if (s->ngram_mode & 0x01000 && feature_enabled(key)) { set_index_value(key, v->mfv.max_byte_streak.tot); }
+    if (c->ngram_mode & 0x01000 && feature_enabled(key)) { set_index_value(key, v->mfv.max_byte_streak.tot); }
     key = STATS_IDX_LO_ASCII_FREQ;
-    if (s->ngram_mode & 0x02000 && feature_enabled(key)) { set_index_value(key, v->mfv.lo_ascii_freq.avg); }
+    if (c->ngram_mode & 0x02000 && feature_enabled(key)) { set_index_value(key, v->mfv.lo_ascii_freq.avg); }
     key = STATS_IDX_MED_ASCII_FREQ;
-    if (s->ngram_mode & 0x04000 && feature_enabled(key)) { set_index_value(key, v->mfv.med_ascii_freq.avg); }
+    if (c->ngram_mode & 0x04000 && feature_enabled(key)) { set_index_value(key, v->mfv.med_ascii_freq.avg); }
     key = STATS_IDX_HI_ASCII_FREQ;
-    if (s->ngram_mode & 0x08000 && feature_enabled(key)) { set_index_value(key, v->mfv.hi_ascii_freq.avg); }
+    if (c->ngram_mode & 0x08000 && feature_enabled(key)) { set_index_value(key, v->mfv.hi_ascii_freq.avg); }
     key = STATS_IDX_BYTE_VAL_CORRELATION;
-    if (s->ngram_mode & 0x10000 && feature_enabled(key)) { set_index_value(key, v->mfv.byte_val_correlation); }
+    if (c->ngram_mode & 0x10000 && feature_enabled(key)) { set_index_value(key, v->mfv.byte_val_correlation); }
     key = STATS_IDX_BYTE_VAL_FREQ_CORRELATION;
-    if (s->ngram_mode & 0x20000 && feature_enabled(key)) { set_index_value(key, v->mfv.byte_val_freq_correlation); }
+    if (c->ngram_mode & 0x20000 && feature_enabled(key)) { set_index_value(key, v->mfv.byte_val_freq_correlation); }
     key = STATS_IDX_UNI_CHI_SQ;
-    if (s->ngram_mode & 0x40000 && feature_enabled(key)) { set_index_value(key, v->mfv.uni_chi_sq); }
+    if (c->ngram_mode & 0x40000 && feature_enabled(key)) { set_index_value(key, v->mfv.uni_chi_sq); }
 
     /* Add the Bias if we are using Bias. It goes last, apparently */
-    if (s->model && s->model->bias >= 0 ) {
-        set_index_value(get_nr_feature( s->model ) + 1, s->model->bias);
+    if (c->model && c->model->bias >= 0 ) {
+        set_index_value(get_nr_feature( c->model ) + 1, c->model->bias);
     }
     /* And note that we are at the end of the vectors */
     assert (idx < MAX_NR_ATTR) ;
@@ -401,9 +534,9 @@ static void build_nodes_from_vectors(const sceadan *s, const sceadan_vectors_t *
 }
 
 
-static void dump_vectors_as_json(const sceadan *s,const sceadan_vectors_t *v)
+static void dump_vectors_as_json(const sceadan_ctx *ctx,const sceadan_vectors_t *v)
 {
-    printf("{ \"file_type\": %d,\n",s->file_type);
+    printf("{ \"file_type\": %d,\n",ctx->file_type);
     if(v->file_name) printf("  \"file_name\": \"%s\",\n",v->file_name);
     printf("  \"unigrams\": { \n");
     int first = 1;
@@ -455,9 +588,9 @@ static void dump_vectors_as_json(const sceadan *s,const sceadan_vectors_t *v)
     printf("}\n");
 }
 
-static void dump_nodes(FILE *out,const sceadan *s,const struct feature_node *x)
+static void dump_nodes(FILE *out,const sceadan_ctx *ctx,const struct feature_node *x)
 {
-    fprintf(out,"%d ",s->file_type);
+    fprintf(out,"%d ",ctx->file_type);
     for(int i=0;i<MAX_NR_ATTR;i++){
         if (x[i].index && x[i].value>0) fprintf(out,"%d:%g ",x[i].index,x[i].value);
         if (x[i].index == -1) break;
@@ -469,7 +602,7 @@ static void dump_nodes(FILE *out,const sceadan *s,const struct feature_node *x)
  *** VECTOR GENERATION FUNCTIONS
  ****************************************************************/
 
-static void vectors_update (const sceadan *s,const uint8_t buf[], const size_t sz, sceadan_vectors_t *v)
+static void vectors_update (int ngram_mode,const uint8_t buf[], const size_t sz, sceadan_vectors_t *v)
 {
     for (size_t ndx = 0; ndx < sz; ndx++) { /* ndx is index within the buffer */
 
@@ -492,11 +625,11 @@ static void vectors_update (const sceadan *s,const uint8_t buf[], const size_t s
         if (v->mfv.unigram_count>0){                 /* only process bigrams on characters >=1 */
             int parity = v->mfv.unigram_count % 2;
 
-            if (s->ngram_mode & 1) v->bcv_all[v->prev_value][unigram].tot++;
+            if (ngram_mode & 1) v->bcv_all[v->prev_value][unigram].tot++;
             if (parity == 0) {
-                if (s->ngram_mode & 2) v->bcv_even[v->prev_value][unigram].tot++;
+                if (ngram_mode & 2) v->bcv_even[v->prev_value][unigram].tot++;
             } else {
-                if (s->ngram_mode & 4) v->bcv_odd[v->prev_value][unigram].tot++;
+                if (ngram_mode & 4) v->bcv_odd[v->prev_value][unigram].tot++;
             }
 
             v->mfv.contiguity.tot += abs (unigram - v->prev_value);
@@ -515,6 +648,26 @@ static void vectors_update (const sceadan *s,const uint8_t buf[], const size_t s
     }
 }
 
+/* Add n zero bytes as vectors_update() would, without scanning them.
+ * After the first, each is a (0,0) bigram that extends a streak of zeros.
+ */
+static void vectors_update_zeros(int ngram_mode,uint64_t n,sceadan_vectors_t *v)
+{
+    static const uint8_t zero = 0;
+    if(n==0) return;
+    vectors_update(ngram_mode,&zero,1,v);   // follows whatever came before
+    if(--n==0) return;
+    const uint64_t evens = (n + (v->mfv.unigram_count % 2 == 0 ? 1 : 0)) / 2; // at even positions
+    v->ucv[0].tot += n;
+    v->mfv.lo_ascii_freq.tot += n;
+    if (ngram_mode & 1) v->bcv_all[0][0].tot += n;
+    if (ngram_mode & 2) v->bcv_even[0][0].tot += evens;
+    if (ngram_mode & 4) v->bcv_odd[0][0].tot += n - evens;
+    v->prev_count += n;
+    v->mfv.max_byte_streak.tot = max(v->prev_count, v->mfv.max_byte_streak.tot);
+    v->mfv.unigram_count += n;
+}
+
 static void vectors_finalize ( sceadan_vectors_t *v)
 {
     // hamming weight
@@ -595,54 +748,129 @@ static void vectors_finalize ( sceadan_vectors_t *v)
     v->mfv.hi_ascii_freq.avg  = (double) v->mfv.hi_ascii_freq.tot  / v->mfv.unigram_count;
 }
 
-/* predict the vectors with a model and return the predicted type.
- * 
- * That is to handle vectors of too little or too much
- * variance/entropy, e.g. a file of all 0x00s will be considered
- * CONSTANT, or a file of all random unigrams will be considered
- * RANDOM. We consider those vectors abnormal and taken special care
- * of, instead of predicting. 
+/* Distance between the winning decision value and the runner-up.
+ * Two-class models (other than Crammer-Singer) have a single decision value.
  */
-static int sceadan_predict(const sceadan *s,sceadan_vectors_t *v)
+static double decision_margin(const struct model *model,const double *dec_values)
 {
-    int ret = 0;
+    if(model->nr_class==2 && model->param.solver_type != MCSVM_CS) return fabs(dec_values[0]);
+    double best = -HUGE_VAL, second = -HUGE_VAL;
+    for(int i=0;i<model->nr_class;i++){
+        if(dec_values[i]>best){
+            second = best;
+            best = dec_values[i];
+        } else if(dec_values[i]>second){
+            second = dec_values[i];
+        }
+    }
+    return best - second;
+}
 
-    vectors_finalize(v);
-    if(s->dump_json){                        /* dumping, not predicting */
-        dump_vectors_as_json(s,v);
-        return 0;
+/* The ngram_mode that vectors are accumulated with: what any model needs */
+static int extraction_mode(const sceadan *s)
+{
+    classifier_guard g(s);
+    int mode = 0;
+    for(size_t i=0;i<g.size();i++) mode |= g[i]->ngram_mode;
+    return mode;
+}
+
+/****************************************************************
+ *** Feature statistics
+ ****************************************************************/
+
+/* Per-type count of vectors and per-feature sums of values and of
+ * squared values. That is enough for chi-square and ANOVA F scores,
+ * so features can be ranked while the training vectors are generated,
+ * before any model is trained. Runs are merged by adding the sums.
+ */
+struct type_stats {
+    type_stats():count(0),sum(MAX_NR_ATTR),sumsq(MAX_NR_ATTR){}
+    uint64_t count;
+    std::vector<double> sum;
+    std::vector<double> sumsq;
+};
+
+struct feature_stats {
+    feature_stats():types(){}
+    std::map<int,type_stats> types;     // allocated as types are seen
+};
+
+static void stats_update(feature_stats *fs,int type,const struct feature_node *x)
+{
+    type_stats &ts = fs->types[type];
+    ts.count++;
+    for(;x->index != -1;x++){
+        if(x->index < MAX_NR_ATTR){     // not the bias; zeros add nothing
+            ts.sum[x->index]   += x->value;
+            ts.sumsq[x->index] += x->value * x->value;
+        }
     }
+}
 
+/* predict finalized vectors with classifier c and return the predicted type.
+ * If margin is provided, it is set to the decision margin of the prediction.
+ * If stats is provided, the feature nodes are added to it.
+ */
+static int predict_vectors(const sceadan_ctx *ctx,const sceadan_classifier *c,const sceadan_vectors_t *v,double *margin=0,
+                           feature_stats *stats=0)
+{
+    int ret = 0;
     struct feature_node *x = (struct feature_node *) calloc(MAX_NR_ATTR,sizeof(struct feature_node));
-    build_nodes_from_vectors(s,v, x);
+    build_nodes_from_vectors(c,v, x);
+    if(stats) stats_update(stats,ctx->stats_type,x);
     
-    if(s->dump_nodes){
-        dump_nodes(s->dump_nodes,s,x);
+    if(ctx->dump_nodes){
+        dump_nodes(ctx->dump_nodes,ctx,x);
     } else {
-        if(s->model==0){
+        if(c->model==0){
             fprintf(stderr,"Cannot run sceadan_predict with no built-in model\n");
             exit(1);
         }
-        ret = predict(s->model,x);           /* run the liblinear predictor */
+        if(margin){
+            std::vector<double> dec_values(c->model->nr_class);
+            ret = predict_values(c->model,x,&dec_values[0]);
+            *margin = decision_margin(c->model,&dec_values[0]);
+        } else {
+            ret = predict(c->model,x);           /* run the liblinear predictor */
+        }
     }
     free(x);
     return ret;
 }
 
+/* predict the vectors with a model and return the predicted type.
+ * 
+ * That is to handle vectors of too little or too much
+ * variance/entropy, e.g. a file of all 0x00s will be considered
+ * CONSTANT, or a file of all random unigrams will be considered
+ * RANDOM. We consider those vectors abnormal and taken special care
+ * of, instead of predicting. 
+ */
+static int sceadan_predict(const sceadan_ctx *ctx,sceadan_vectors_t *v)
+{
+    vectors_finalize(v);
+    if(ctx->dump_json){                        /* dumping, not predicting */
+        dump_vectors_as_json(ctx,v);
+        return 0;
+    }
+    classifier_guard g(ctx->s);
+    return predict_vectors(ctx,g[0],v,0,ctx->stats);
+}
 
-const struct model *sceadan_model_default()
+/* Predict the vectors with every model of s. The vectors are finalized once.
+ * When dumping, only the primary model is used and the other types are 0.
+ */
+static void sceadan_predict_all(const sceadan_ctx *ctx,sceadan_vectors_t *v,int *types)
 {
-    static struct model *default_model = 0;               /* this assures that the model will only be loaded once */
-    if(default_model==0){
-        default_model=load_model(MODEL_DEFAULT_FILENAME);
-        if(default_model==0){
-            fprintf(stderr,"can't open model file %s\n","");
-            return 0;
-        }
+    types[0] = sceadan_predict(ctx,v);
+    classifier_guard g(ctx->s);
+    for(size_t i=1;i<g.size();i++){
+        types[i] = (ctx->dump_json || ctx->dump_nodes) ? 0 : predict_vectors(ctx,g[i],v);
     }
-    return default_model;
 }
 
+
 void sceadan_model_dump(const struct model *model,FILE *f)
 {
     if(model->param.nr_weight){
@@ -730,7 +958,8 @@ void sceadan_model_dump(const struct model *model,FILE *f)
 
 const char *sceadan_model_name(sceadan *s)
 {
-    return s->model_name.c_str();
+    classifier_guard g(s);
+    return g[0]->model_name;
 }
 
 /****************************************************************
@@ -738,47 +967,78 @@ const char *sceadan_model_name(sceadan *s)
  ****************************************************************/
 
 
-void sceadan_initialize_feature_mask(sceadan *s)     // initialize feature_mask based on ngram_mode
+static void build_feature_mask(char *mask,int ngram_mode)     // feature_mask based on ngram_mode
 {
     int count = 0;
-    memset(s->mask, '0', MAX_NR_ATTR);
+    memset(mask, '0', MAX_NR_ATTR);
     /* unigrams */
-    memset(s->mask+START_UNIGRAMS, '1', NUNIGRAMS);
+    memset(mask+START_UNIGRAMS, '1', NUNIGRAMS);
     count += NUNIGRAMS;
     /* bigrams */
-    if(s->ngram_mode & 1){
-        memset(s->mask+START_BIGRAMS_ALL, '1', NBIGRAMS);
+    if(ngram_mode & 1){
+        memset(mask+START_BIGRAMS_ALL, '1', NBIGRAMS);
         count += NBIGRAMS;
     }
-    if(s->ngram_mode & 2){
-        memset(s->mask+START_BIGRAMS_EVEN, '1', NBIGRAMS);
+    if(ngram_mode & 2){
+        memset(mask+START_BIGRAMS_EVEN, '1', NBIGRAMS);
         count += NBIGRAMS;
     }
-    if(s->ngram_mode & 4){
-        memset(s->mask+START_BIGRAMS_ODD, '1', NBIGRAMS);
+    if(ngram_mode & 4){
+        memset(mask+START_BIGRAMS_ODD, '1', NBIGRAMS);
         count += NBIGRAMS;
     }
     /* stats */
-    if (s->ngram_mode & 0x00008) { s->mask[STATS_IDX_BIGRAM_ENTROPY]            = '1'; count ++; }
-    if (s->ngram_mode & 0x00010) { s->mask[STATS_IDX_ITEM_ENTROPY]              = '1'; count ++; }
-    if (s->ngram_mode & 0x00020) { s->mask[STATS_IDX_HAMMING_WEIGHT]            = '1'; count ++; }
-    if (s->ngram_mode & 0x00040) { s->mask[STATS_IDX_MEAN_BYTE_VALUE]           = '1'; count ++; }
-    if (s->ngram_mode & 0x00080) { s->mask[STATS_IDX_STDDEV_BYTE_VAL]           = '1'; count ++; }
-    if (s->ngram_mode & 0x00100) { s->mask[STATS_IDX_ABS_DEV]                   = '1'; count ++; }
-    if (s->ngram_mode & 0x00200) { s->mask[STATS_IDX_SKEWNESS]                  = '1'; count ++; }
-    if (s->ngram_mode & 0x00400) { s->mask[STATS_IDX_KURTOSIS]                  = '1'; count ++; }
-    if (s->ngram_mode & 0x00800) { s->mask[STATS_IDX_CONTIGUITY]                = '1'; count ++; }
-    if (s->ngram_mode & 0x01000) { s->mask[STATS_IDX_MAX_BYTE_STREAK]           = '1'; count ++; }
-    if (s->ngram_mode & 0x02000) { s->mask[STATS_IDX_LO_ASCII_FREQ]             = '1'; count ++; }
-    if (s->ngram_mode & 0x04000) { s->mask[STATS_IDX_MED_ASCII_FREQ]            = '1'; count ++; }
-    if (s->ngram_mode & 0x08000) { s->mask[STATS_IDX_HI_ASCII_FREQ]             = '1'; count ++; }
-    if (s->ngram_mode & 0x10000) { s->mask[STATS_IDX_BYTE_VAL_CORRELATION]      = '1'; count ++; }
-    if (s->ngram_mode & 0x20000) { s->mask[STATS_IDX_BYTE_VAL_FREQ_CORRELATION] = '1'; count ++; }
-    if (s->ngram_mode & 0x40000) { s->mask[STATS_IDX_UNI_CHI_SQ]                = '1'; count ++; }
+    if (ngram_mode & 0x00008) { mask[STATS_IDX_BIGRAM_ENTROPY]            = '1'; count ++; }
+    if (ngram_mode & 0x00010) { mask[STATS_IDX_ITEM_ENTROPY]              = '1'; count ++; }
+    if (ngram_mode & 0x00020) { mask[STATS_IDX_HAMMING_WEIGHT]            = '1'; count ++; }
+    if (ngram_mode & 0x00040) { mask[STATS_IDX_MEAN_BYTE_VALUE]           = '1'; count ++; }
+    if (ngram_mode & 0x00080) { mask[STATS_IDX_STDDEV_BYTE_VAL]           = '1'; count ++; }
+    if (ngram_mode & 0x00100) { mask[STATS_IDX_ABS_DEV]                   = '1'; count ++; }
+    if (ngram_mode & 0x00200) { mask[STATS_IDX_SKEWNESS]                  = '1'; count ++; }
+    if (ngram_mode & 0x00400) { mask[STATS_IDX_KURTOSIS]                  = '1'; count ++; }
+    if (ngram_mode & 0x00800) { mask[STATS_IDX_CONTIGUITY]                = '1'; count ++; }
+    if (ngram_mode & 0x01000) { mask[STATS_IDX_MAX_BYTE_STREAK]           = '1'; count ++; }
+    if (ngram_mode & 0x02000) { mask[STATS_IDX_LO_ASCII_FREQ]             = '1'; count ++; }
+    if (ngram_mode & 0x04000) { mask[STATS_IDX_MED_ASCII_FREQ]            = '1'; count ++; }
+    if (ngram_mode & 0x08000) { mask[STATS_IDX_HI_ASCII_FREQ]             = '1'; count ++; }
+    if (ngram_mode & 0x10000) { mask[STATS_IDX_BYTE_VAL_CORRELATION]      = '1'; count ++; }
+    if (ngram_mode & 0x20000) { mask[STATS_IDX_BYTE_VAL_FREQ_CORRELATION] = '1'; count ++; }
+    if (ngram_mode & 0x40000) { mask[STATS_IDX_UNI_CHI_SQ]                = '1'; count ++; }
+}
+
+/* Masks built from an ngram_mode depend only on the mode. They are
+ * built once and shared, and never freed.
+ */
+static const char *shared_feature_mask(int ngram_mode)
+{
+    static std::mutex lock;
+    static std::map<int,const char *> masks;
+    std::lock_guard<std::mutex> guard(lock);
+    const char *&mask = masks[ngram_mode];
+    if(mask==0){
+        char *m = (char *)malloc(MAX_NR_ATTR);
+        build_feature_mask(m,ngram_mode);
+        mask = m;
+    }
+    return mask;
+}
+
+static void sceadan_initialize_feature_mask(sceadan_classifier *c)     // initialize feature_mask based on ngram_mode
+{
+    c->mask = shared_feature_mask(c->ngram_mode);
+    free(c->own_mask);
+    c->own_mask = 0;
+}
 
+/* Replace the mask of c with mask, which c now owns */
+static void set_own_mask(sceadan_classifier *c,char *mask)
+{
+    free(c->own_mask);
+    c->own_mask = mask;
+    c->mask     = mask;
 }
 
-int sceadan_load_feature_mask(sceadan *s,const char *file_name)
+static int load_feature_mask(sceadan_classifier *c,const char *file_name)
 {
     int count=0;
     FILE *fp = fopen(file_name, "r");
@@ -786,24 +1046,33 @@ int sceadan_load_feature_mask(sceadan *s,const char *file_name)
         printf("sceadan: error opening mask file %s\n", file_name);
         return -1;
     }
-    memset(s->mask, '0', MAX_NR_ATTR);
+    char *mask = (char *)malloc(MAX_NR_ATTR);
+    memset(mask, '0', MAX_NR_ATTR);
     for(int i = 0; i < MAX_NR_ATTR; i++){
         int ch = fgetc(fp);
         assert(ch=='0' || ch=='1');
         if(ch=='1'){
-            s->mask[i] = char(ch);
+            mask[i] = char(ch);
             count ++;
         }
     }
+    set_own_mask(c,mask);
     if(fclose(fp) < 0){
         printf("sceadan: error closing mask file %s\n", file_name);
         return -1;
     }
     // make sure feature_mask match the model
-    assert(count==get_nr_feature( s->model ));
+    assert(count==get_nr_feature( c->model ));
     return 0;
 }
 
+int sceadan_load_feature_mask(sceadan *s,const char *file_name)
+{
+    sceadan_classifier *c = s->models[0];
+    c->mask_file = s->name_pool.insert(file_name).first->c_str();
+    return load_feature_mask(c,file_name);
+}
+
 int sceadan_dump_feature_mask(sceadan *s,const char *file_name)
 {
     FILE *fp = fopen(file_name, "w");
@@ -811,7 +1080,8 @@ int sceadan_dump_feature_mask(sceadan *s,const char *file_name)
         printf("Sceadan: Error opening mask dump file %s\n", file_name);
         return -1;
     }
-    if(fwrite(s->mask, sizeof(char), MAX_NR_ATTR, fp) != (size_t) MAX_NR_ATTR){
+    const sceadan_classifier *c = s->models[0];
+    if(fwrite(c->mask, sizeof(char), MAX_NR_ATTR, fp) != (size_t) MAX_NR_ATTR){
         printf("Error writing file %s\n", file_name);
         fclose(fp);
         return -1;
@@ -824,65 +1094,448 @@ int sceadan_dump_feature_mask(sceadan *s,const char *file_name)
 }
 
 /****************************************************************
- *** Feature mask
+ *** Binary model bundles
+ ****************************************************************/
+
+/* A bundle is a single file holding everything that sceadan_open()
+ * otherwise assembles from a liblinear model file, a class file and a
+ * feature mask file. Everything is stored in native byte order; the
+ * weights start on a 2 MiB boundary so that the file can be mapped
+ * read-only, shared between processes and backed by huge pages.
+ */
+#define BUNDLE_MAGIC     "SCEADANB"
+#define BUNDLE_VERSION   1
+#define BUNDLE_BYTEORDER 0x01020304
+#define BUNDLE_ALIGN     (2*1024*1024)
+
+struct bundle_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t byteorder;
+    int32_t  solver_type;
+    int32_t  nr_class;
+    int32_t  nr_feature;
+    int32_t  nr_w;
+    double   bias;
+    int32_t  ngram_mode;
+    int32_t  nr_types;
+    uint64_t label_offset;              /* int32_t[nr_class] */
+    uint64_t w_offset;                  /* double[w_count] */
+    uint64_t w_count;
+    uint64_t types_offset;              /* nr_types NUL-terminated names in type order */
+    uint64_t types_size;
+    uint64_t mask_offset;               /* MAX_NR_ATTR '0'/'1' characters; 0 if none */
+    uint64_t mask_size;
+    uint64_t file_size;
+};
+
+static int model_nr_w(const struct model *model)
+{
+    return (model->nr_class==2 && model->param.solver_type != MCSVM_CS) ? 1 : model->nr_class;
+}
+
+static int model_w_size(const struct model *model)
+{
+    return model->bias>=0 ? model->nr_feature+1 : model->nr_feature;
+}
+
+/* Write a bundle for model. Types, mask and ngram_mode come from c if it is provided.
+ * The weights are placed at the first multiple of align after the labels.
+ */
+static bool write_bundle(FILE *fp,const struct model *model,const sceadan_classifier *c,uint64_t align)
+{
+    /* Type names in type order */
+    std::vector<const char *> names;
+    if(c) names = c->types->names;
+    std::string type_blob;
+    for(size_t i=0;i<names.size();i++){
+        type_blob.append(names[i]);
+        type_blob.push_back('\0');
+    }
+    const char *mask = c ? c->mask : 0;
+
+    struct bundle_header h;
+    memset(&h,0,sizeof(h));
+    memcpy(h.magic,BUNDLE_MAGIC,sizeof(h.magic));
+    h.version      = BUNDLE_VERSION;
+    h.byteorder    = BUNDLE_BYTEORDER;
+    h.solver_type  = model->param.solver_type;
+    h.nr_class     = model->nr_class;
+    h.nr_feature   = model->nr_feature;
+    h.nr_w         = model_nr_w(model);
+    h.bias         = model->bias;
+    h.ngram_mode   = c ? c->ngram_mode : SCEADAN_NGRAM_MODE_DEFAULT;
+    h.nr_types     = names.size();
+    h.label_offset = sizeof(h);
+    h.w_offset     = (h.label_offset + h.nr_class*sizeof(int32_t) + align-1) / align * align;
+    h.w_count      = (uint64_t)model_w_size(model) * h.nr_w;
+    h.types_offset = h.w_offset + h.w_count*sizeof(double);
+    h.types_size   = type_blob.size();
+    h.mask_offset  = mask ? h.types_offset + h.types_size : 0;
+    h.mask_size    = mask ? MAX_NR_ATTR : 0;
+    h.file_size    = h.types_offset + h.types_size + h.mask_size;
+
+    std::vector<int32_t> labels(model->label,model->label+h.nr_class);
+    std::vector<char> pad(h.w_offset - h.label_offset - labels.size()*sizeof(int32_t));
+    return fwrite(&h,sizeof(h),1,fp)==1
+        && fwrite(&labels[0],sizeof(int32_t),labels.size(),fp)==labels.size()
+        && (pad.empty() || fwrite(&pad[0],1,pad.size(),fp)==pad.size())
+        && fwrite(model->w,sizeof(double),h.w_count,fp)==h.w_count
+        && fwrite(type_blob.data(),1,type_blob.size(),fp)==type_blob.size()
+        && (h.mask_size==0 || fwrite(mask,1,h.mask_size,fp)==h.mask_size);
+}
+
+int sceadan_save_bundle(const sceadan *s,const char *file_name)
+{
+    const sceadan_classifier *c = s->models[0];
+    if(c->model==0){
+        fprintf(stderr,"sceadan: cannot write a bundle with no model\n");
+        return -1;
+    }
+    FILE *fp = fopen(file_name,"wb");
+    if(fp==NULL){
+        fprintf(stderr,"sceadan: error opening bundle file %s\n",file_name);
+        return -1;
+    }
+    bool ok = write_bundle(fp,c->model,c,BUNDLE_ALIGN);
+    if(fclose(fp)<0) ok = false;
+    if(!ok){
+        fprintf(stderr,"sceadan: error writing bundle file %s\n",file_name);
+        return -1;
+    }
+    return 0;
+}
+
+/* A blob is a bundle of just the model, compact enough to be linked into the program */
+#define BLOB_ALIGN 16
+
+int sceadan_model_save_blob(const struct model *model,FILE *f)
+{
+    return write_bundle(f,model,0,BLOB_ALIGN) ? 0 : -1;
+}
+
+/* Whether count items of size bytes at offset lie within file_size bytes, without overflowing */
+static bool bundle_region_valid(uint64_t offset,uint64_t count,uint64_t size,uint64_t file_size)
+{
+    return offset<=file_size && count <= (file_size-offset)/size;
+}
+
+/* The header must describe a model that liblinear can predict with
+ * without reading outside the bundle: a corrupt or truncated bundle is
+ * rejected here, since it is used in place.
+ */
+static bool bundle_header_valid(const struct bundle_header *h,uint64_t size)
+{
+    if(memcmp(h->magic,BUNDLE_MAGIC,sizeof(h->magic))!=0
+       || h->version!=BUNDLE_VERSION || h->byteorder!=BUNDLE_BYTEORDER
+       || h->file_size > size || h->file_size < sizeof(*h)){
+        return false;
+    }
+    if(h->nr_class<=0 || h->nr_feature<0 || h->nr_types<0) return false;
+    const int nr_w = (h->nr_class==2 && h->solver_type!=MCSVM_CS) ? 1 : h->nr_class;
+    const uint64_t w_size = (uint64_t)h->nr_feature + (h->bias>=0 ? 1 : 0);
+    return h->nr_w==nr_w
+        && h->w_count==w_size*nr_w
+        && h->label_offset>=sizeof(*h) && h->label_offset % sizeof(int32_t) == 0
+        && bundle_region_valid(h->label_offset,h->nr_class,sizeof(int32_t),h->file_size)
+        && h->w_offset>=sizeof(*h) && h->w_offset % sizeof(double) == 0
+        && bundle_region_valid(h->w_offset,h->w_count,sizeof(double),h->file_size)
+        && bundle_region_valid(h->types_offset,h->types_size,1,h->file_size)
+        && bundle_region_valid(h->mask_offset,h->mask_size,1,h->file_size)
+        && (h->mask_size==0 || h->mask_size==MAX_NR_ATTR);
+}
+
+/* Point m at the labels and weights of the bundle that starts at base */
+static void bundle_fill_model(struct model *m,const struct bundle_header *h,const uint8_t *base)
+{
+    memset(m,0,sizeof(*m));
+    m->param.solver_type = h->solver_type;
+    m->nr_class   = h->nr_class;
+    m->nr_feature = h->nr_feature;
+    m->bias       = h->bias;
+    m->label      = (int *)(base + h->label_offset);
+    m->w          = (double *)(base + h->w_offset);
+}
+
+int sceadan_model_from_blob(struct model *m,const void *blob,size_t len)
+{
+    const struct bundle_header *h = (const struct bundle_header *)blob;
+    if(len<sizeof(*h) || !bundle_header_valid(h,len)) return -1;
+    bundle_fill_model(m,h,(const uint8_t *)blob);
+    return 0;
+}
+
+/* Map len bytes of fd read-only, starting on a huge-page boundary when possible.
+ * Without mmap the file is simply read into memory.
+ */
+static void *bundle_map(int fd,size_t len)
+{
+#ifdef HAVE_SYS_MMAN_H
+    /* Reserve enough address space to place the mapping on an aligned address */
+    const size_t reserve = len + BUNDLE_ALIGN;
+    uint8_t *base = (uint8_t *)mmap(0,reserve,PROT_NONE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+    if(base==MAP_FAILED) return 0;
+    uint8_t *aligned = (uint8_t *)(((uintptr_t)base + BUNDLE_ALIGN-1) & ~(uintptr_t)(BUNDLE_ALIGN-1));
+    if(mmap(aligned,len,PROT_READ,MAP_SHARED|MAP_FIXED,fd,0)==MAP_FAILED){
+        munmap(base,reserve);
+        return 0;
+    }
+    const size_t pagesize = sysconf(_SC_PAGESIZE);
+    uint8_t *map_end = aligned + (len+pagesize-1)/pagesize*pagesize;
+    if(aligned>base) munmap(base,aligned-base);
+    if(map_end<base+reserve) munmap(map_end,(base+reserve)-map_end);
+    return aligned;
+#else
+    uint8_t *buf = (uint8_t *)malloc(len);
+    if(buf==0) return 0;
+    for(size_t got=0;got<len;){
+        const ssize_t rd = read(fd,buf+got,len-got);
+        if(rd<=0){ free(buf); return 0; }
+        got += rd;
+    }
+    return buf;
+#endif
+}
+
+static void bundle_unmap(void *map,size_t len)
+{
+#ifdef HAVE_SYS_MMAN_H
+    munmap(map,len);
+#else
+    (void)len;
+    free(map);
+#endif
+}
+
+/****************************************************************
+ *** Model registry
+ ****************************************************************/
+
+/* Every model that is loaded from a file is kept in a process-wide
+ * registry, keyed by the identity of the file (device, inode, size
+ * and modification time), so that all of the handles that open the
+ * same model share one read-only copy. The entry is freed when the
+ * last handle that uses it is closed.
+ */
+struct model_entry {
+private:
+    model_entry(const model_entry &);
+    model_entry &operator=(const model_entry &);
+public:
+    model_entry():key(),model(),map(),map_len(),bundle(),refs(){}
+    std::string key;
+    struct model *model;                // from load_model(), or pointing into map
+    void   *map;                        // mapped bundle; 0 for liblinear text models
+    size_t map_len;
+    const struct bundle_header *bundle; // header within map
+    int    refs;
+};
+
+static std::mutex registry_mutex;       // protects registry and refs
+static std::map<std::string,model_entry *> registry;
+
+static std::string registry_key(const char *file_name)
+{
+    struct stat st;
+    if(stat(file_name,&st)!=0) return file_name;
+    std::stringstream ss;
+    ss << st.st_dev << ':' << st.st_ino << ':' << st.st_size << ':' << st.st_mtime;
+    return ss.str();
+}
+
+/* Load a bundle into e.
+ * Returns 0 if loaded, 1 if the file is not a bundle, -1 if it is a bad bundle.
+ */
+static int bundle_load(model_entry *e,const char *file_name)
+{
+    const int fd = open(file_name, O_RDONLY|O_BINARY);
+    if(fd<0) return 1;                  /* let load_model() report it */
+    struct bundle_header h;
+    if(read(fd,&h,sizeof(h))!=(ssize_t)sizeof(h) || memcmp(h.magic,BUNDLE_MAGIC,sizeof(h.magic))!=0){
+        close(fd);
+        return 1;
+    }
+    struct stat st;
+    if(fstat(fd,&st)!=0 || !bundle_header_valid(&h,st.st_size)){
+        fprintf(stderr,"sceadan: %s is not a valid version %d bundle\n",file_name,BUNDLE_VERSION);
+        close(fd);
+        return -1;
+    }
+    uint8_t *map = (uint8_t *)bundle_map(fd,h.file_size);
+    close(fd);
+    if(map==0){
+        fprintf(stderr,"sceadan: cannot map bundle %s\n",file_name);
+        return -1;
+    }
+#ifdef HAVE_SYS_MMAN_H
+#ifdef MADV_HUGEPAGE
+    madvise(map,h.file_size,MADV_HUGEPAGE);
+#endif
+    madvise(map,h.file_size,MADV_WILLNEED);
+#endif
+    e->map     = map;
+    e->map_len = h.file_size;
+    e->bundle  = (const struct bundle_header *)map;
+    e->model   = (struct model *)calloc(1,sizeof(struct model));
+    bundle_fill_model(e->model,e->bundle,map);
+    return 0;
+}
+
+static void model_entry_free(model_entry *e)
+{
+    if(e->map){
+        free(e->model);
+        bundle_unmap(e->map,e->map_len);
+    } else if(e->model){
+        free_and_destroy_model(&e->model);
+    }
+    delete e;
+}
+
+/* Return the registry entry for file_name with an added reference, loading it if needed */
+static model_entry *model_acquire(const char *file_name)
+{
+    const std::string key = registry_key(file_name);
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    std::map<std::string,model_entry *>::iterator it = registry.find(key);
+    if(it!=registry.end()){
+        it->second->refs++;
+        return it->second;
+    }
+    model_entry *e = new model_entry();
+    e->key = key;
+    switch(bundle_load(e,file_name)){
+    case 0: break;
+    case 1:
+        e->model = load_model(file_name);
+        if(e->model) break;
+        fprintf(stderr,"sceadan: %s will not load as a model file\n",file_name);
+        /* FALLTHROUGH */
+    default:
+        model_entry_free(e);
+        return 0;
+    }
+    e->refs = 1;
+    registry[key] = e;
+    return e;
+}
+
+static void model_release(model_entry *e)
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    if(--e->refs > 0) return;
+    registry.erase(e->key);
+    model_entry_free(e);
+}
+
+/* The default model file is loaded once and is never released. */
+const struct model *sceadan_model_default()
+{
+    static model_entry *default_entry = model_acquire(MODEL_DEFAULT_FILENAME);
+    if(default_entry==0){
+        fprintf(stderr,"can't open model file %s\n",MODEL_DEFAULT_FILENAME);
+        return 0;
+    }
+    return default_entry->model;
+}
+
+/* Use the types, mask and ngram_mode of a bundle for c. The mask is
+ * used in place; c holds the entry, so it stays mapped.
+ */
+static const char *intern(sceadan *s,const std::string &str);
+
+static void bundle_apply(sceadan *s,sceadan_classifier *c,const model_entry *e,const char *mask_file)
+{
+    const struct bundle_header *h = e->bundle;
+    const uint8_t *map = (const uint8_t *)e->map;
+    c->ngram_mode = h->ngram_mode;
+
+    if(h->nr_types>0){
+        c->own_types = new type_table();
+        c->types = c->own_types;
+        const char *name = (const char *)(map + h->types_offset);
+        const char *end  = name + h->types_size;
+        for(int i=0;i<h->nr_types && name<end;i++){
+            const char *nul = (const char *)memchr(name,0,end-name);
+            if(nul==0) break;                       // an unterminated name
+            c->own_types->add(intern(s,std::string(name,nul-name)));  // outlives a reload, unlike the map
+            name = nul+1;
+        }
+    }
+    if(h->mask_size){
+        c->mask = (const char *)(map + h->mask_offset);
+        c->mask_file = mask_file;       /* the mask is not derived from ngram_mode */
+    }
+}
+
+/****************************************************************
+ *** Opening and closing
  ****************************************************************/
 
+static const char *intern(sceadan *s,const std::string &str)
+{
+    return s->name_pool.insert(str).first->c_str();
+}
+
+static void classifier_free(sceadan_classifier *c)
+{
+    free(c->own_mask);
+    delete c->own_types;
+    if(c->entry) model_release(c->entry);
+    delete c;
+}
 
 /*
- * Open another classifier, reading both a model, a map and a feature_mask.
+ * Build a classifier from a model, a map and a feature_mask.
+ * ngram_mode is used unless the model is a bundle, which has its own.
  */
-sceadan *sceadan_open(const char *model_file,const char *class_file,const char *feature_mask_file) // use 0 for default model
+static sceadan_classifier *classifier_open(sceadan *s,const char *model_file,const char *class_file,
+                                           const char *feature_mask_file,int ngram_mode)
 {
-    sceadan *s    = new sceadan();
+    sceadan_classifier *c = new sceadan_classifier();
+    c->ngram_mode = ngram_mode;
+    c->types = default_types();
 
     if (model_file && model_file[0]) {
-        s->model_name = model_file;
-        s->model = load_model(model_file);
-        if(s->model==0){
-            fprintf(stderr,"sceadan: %s will not load as a model file\n");
-            exit(0);
-        }
+        c->model_name = intern(s,model_file);
+        c->entry = model_acquire(model_file);
+        if(c->entry==0) goto fail;
+        c->model = c->entry->model;
+        /* A bundle brings its own types, mask and ngram_mode */
+        if(c->entry->bundle) bundle_apply(s,c,c->entry,c->model_name);
     } else {
-        s->model = sceadan_model_precompiled();
-        if(s->model){
-            s->model_name = "<precompiled>";
-        } else {
-            s->model_name = "<no model>";
-        }
+        c->model = sceadan_model_precompiled();
+        c->model_name = intern(s,c->model ? "<precompiled>" : "<no model>");
     }
 
-    s->v          = new sceadan_vectors_t();
-    s->ngram_mode = SCEADAN_NGRAM_MODE_DEFAULT;
-    /* Load up the default types */
-    int type_counter = 0;
-    while(sceadan_map_default[type_counter]){
-        s->types[ sceadan_map_default[type_counter] ] = type_counter;
-        type_counter++;
-    }
+    /* The default types are shared; a class file adds to a copy */
     if (class_file && class_file[0]){
         std::ifstream i(class_file);
         if (i.is_open()) {
+            if(c->own_types==0){
+                c->own_types = new type_table(*c->types);
+                c->types = c->own_types;
+            }
             std::string str;
             while(getline(i,str)) {
                 size_t endpos = str.find_last_not_of(" \n\r\t");
                 if (std::string::npos != endpos ) str = str.substr( 0, endpos+1 );
 
                 /* Don't add unless it's not present */
-                
-                if (s->types.find(str) == s->types.end()) {
-                    s->types[ str ] = type_counter++;
+                if (c->own_types->index.find(str) == c->own_types->index.end()) {
+                    c->own_types->add(intern(s,str));
                 }
             }
         }
     }
-    s->mask = (char *)calloc(MAX_NR_ATTR, sizeof(char));
-    s->mask_file = feature_mask_file;
+
     if(feature_mask_file && feature_mask_file[0]){
-        if(sceadan_load_feature_mask(s, feature_mask_file) < 0){
+        c->mask_file = intern(s,feature_mask_file);
+        if(load_feature_mask(c, feature_mask_file) < 0){
             goto fail;
         }
     }
-    else{
+    else if(c->mask_file==0){
         /* if we are not loading feature_mask from file,
          * defer the initialization of feature_mask in 
          * sceadan_set_ngram_mode(), so that we can do 
@@ -896,40 +1549,252 @@ sceadan *sceadan_open(const char *model_file,const char *class_file,const char *
          *      What if model->bias != -1?
          */
         
-        sceadan_initialize_feature_mask(s);
+        sceadan_initialize_feature_mask(c);
     }
-    return s;
+    return c;
 
 fail:
-    sceadan_close(s);                           // will do cleanup
+    classifier_free(c);                 // will do cleanup
     return 0;  
 }
 
+/*
+ * Open another classifier, reading both a model, a map and a feature_mask.
+ */
+sceadan *sceadan_open(const char *model_file,const char *class_file,const char *feature_mask_file) // use 0 for default model
+{
+    sceadan *s    = new sceadan();
+    sceadan_classifier *c = classifier_open(s,model_file,class_file,feature_mask_file,SCEADAN_NGRAM_MODE_DEFAULT);
+    if(c==0){
+        delete s;
+        return 0;
+    }
+    s->models.emplace_back(c);
+    s->ctx        = sceadan_ctx_open(s);
+    return s;
+}
+
+/*
+ * Add another model that is evaluated from the same vectors as the primary model.
+ * A model that is not a bundle gets the primary's ngram_mode; a bundle keeps
+ * its own, and the vectors then also hold the bigrams it needs. Add models
+ * before classifying.
+ * Returns the index of the new model, or -1 if it cannot be opened.
+ */
+int sceadan_add_model(sceadan *s,const char *model_file,const char *class_file,const char *feature_mask_file)
+{
+    const int ngram_mode = s->models[0].load()->ngram_mode;
+    sceadan_classifier *c = classifier_open(s,model_file,class_file,feature_mask_file,ngram_mode);
+    if(c==0) return -1;
+    s->models.emplace_back(c);
+    return (int)s->models.size()-1;
+}
+
+int sceadan_nr_models(const sceadan *s)
+{
+    return (int)s->models.size();
+}
+
+/*
+ * Replace model i (0 is the primary) with a newly loaded model, class
+ * map and mask. Classifications that are running finish with the old
+ * model; the ones that start afterwards use the new one. The caller
+ * does not need to stop classifying, but this waits until the old
+ * model is no longer in use before freeing it.
+ * The new model must have the ngram_mode of the old one, since vectors
+ * that are being accumulated were started with it; a bundle with
+ * another mode is refused with -1.
+ */
+int sceadan_reload(sceadan *s,int i,const char *model_file,const char *class_file,const char *feature_mask_file)
+{
+    if(i<0 || i>=(int)s->models.size()) return -1;
+    std::lock_guard<std::mutex> lock(s->rcu_writer);
+    const int ngram_mode = s->models[i].load()->ngram_mode;
+    sceadan_classifier *c = classifier_open(s,model_file,class_file,feature_mask_file,ngram_mode);
+    if(c==0) return -1;
+    if(c->ngram_mode != ngram_mode){
+        fprintf(stderr,"sceadan: %s has ngram mode %d, not %d of the model it would replace\n",
+                model_file,c->ngram_mode,ngram_mode);
+        classifier_free(c);
+        return -1;
+    }
+
+    sceadan_classifier *old = s->models[i].exchange(c);
+    const unsigned epoch = s->rcu_epoch.load();
+    s->rcu_epoch.store(epoch+1);
+    while(s->rcu_readers[epoch&1].load()!=0){
+        std::this_thread::yield();      // readers that may still hold old
+    }
+    classifier_free(old);
+    return 0;
+}
+
 void sceadan_close(sceadan *s)
 {
-    if (s->v) {
-        delete s->v;
-        s->v = 0;
+    for(size_t i=0;i<s->models.size();i++){
+        classifier_free(s->models[i].load());
     }
-    if(s->mask) { free(s->mask);}
+    s->models.clear();
+    sceadan_ctx_close(s->ctx);
     delete s;
 }
 
+/*
+ * Contexts. Open one per thread; close them before the handle.
+ * The vectors are allocated when they are first used.
+ */
+sceadan_ctx *sceadan_ctx_open(const sceadan *s)
+{
+    return new sceadan_ctx(s);
+}
+
+static sceadan_vectors_t *ctx_vectors(sceadan_ctx *ctx)
+{
+    if(ctx->v==0) ctx->v = new sceadan_vectors_t();
+    return ctx->v;
+}
+
+void sceadan_ctx_close(sceadan_ctx *ctx)
+{
+    if(ctx==0) return;
+    delete ctx->v;
+    delete ctx->stats;
+    delete ctx;
+}
+
+void sceadan_ctx_clear(sceadan_ctx *ctx)
+{
+    if(ctx->v) memset(ctx->v,0,sizeof(sceadan_vectors_t));
+}
+
+void sceadan_ctx_update(sceadan_ctx *ctx,const uint8_t *buf,size_t bufsize)
+{
+    vectors_update(extraction_mode(ctx->s),buf, bufsize, ctx_vectors(ctx));
+}
+
+void sceadan_ctx_update_zeros(sceadan_ctx *ctx,uint64_t count)
+{
+    vectors_update_zeros(extraction_mode(ctx->s),count,ctx_vectors(ctx));
+}
+
+int sceadan_ctx_classify(sceadan_ctx *ctx)
+{
+    int r = sceadan_predict(ctx,ctx_vectors(ctx));
+    sceadan_ctx_clear(ctx);
+    return r;
+}
+
+int sceadan_ctx_classify_all(sceadan_ctx *ctx,int *types)
+{
+    sceadan_predict_all(ctx,ctx_vectors(ctx),types);
+    sceadan_ctx_clear(ctx);
+    return sceadan_nr_models(ctx->s);
+}
+
+/*
+ * Streams cut the data pushed into them into blocks and report each
+ * block through a callback. The chunks are fed to the vectors where
+ * they are, so nothing is copied, and blocks may span chunks.
+ */
+struct sceadan_stream_t {
+    sceadan_ctx      *ctx;
+    size_t           block_size;
+    size_t           in_block;          // bytes of the current block seen so far
+    uint64_t         offset;            // offset of the current block
+    sceadan_block_cb cb;
+    void             *arg;
+};
+
+sceadan_stream *sceadan_stream_open(const sceadan *s,size_t block_size,sceadan_block_cb cb,void *arg)
+{
+    if(block_size==0 || cb==0) return 0;
+    sceadan_stream *st = new sceadan_stream();
+    st->ctx        = sceadan_ctx_open(s);
+    st->block_size = block_size;
+    st->in_block   = 0;
+    st->offset     = 0;
+    st->cb         = cb;
+    st->arg        = arg;
+    return st;
+}
+
+/* classify the current block, report it, and start the next one */
+static void stream_block(sceadan_stream *st)
+{
+    sceadan_ctx *ctx = st->ctx;
+    double margin = 0;
+    int type;
+    vectors_finalize(ctx_vectors(ctx));
+    {
+        classifier_guard g(ctx->s);
+        type = predict_vectors(ctx,g[0],ctx->v,&margin);
+    }
+    sceadan_ctx_clear(ctx);
+    (*st->cb)(st->arg,st->offset,type,margin);
+    st->offset   += st->in_block;
+    st->in_block  = 0;
+}
+
+int sceadan_stream_write(sceadan_stream *st,const uint8_t *buf,size_t len)
+{
+    const int ngram_mode = extraction_mode(st->ctx->s);
+    int blocks = 0;
+    while(len>0){
+        size_t n = st->block_size - st->in_block;
+        if(n>len) n = len;
+        vectors_update(ngram_mode,buf,n,ctx_vectors(st->ctx));
+        st->in_block += n;
+        buf += n;
+        len -= n;
+        if(st->in_block==st->block_size){
+            stream_block(st);
+            blocks++;
+        }
+    }
+    return blocks;
+}
+
+int sceadan_stream_finish(sceadan_stream *st)
+{
+    int blocks = 0;
+    if(st->in_block>0){
+        stream_block(st);
+        blocks++;
+    }
+    st->offset = 0;
+    return blocks;
+}
+
+void sceadan_stream_close(sceadan_stream *st)
+{
+    if(st==0) return;
+    sceadan_ctx_close(st->ctx);
+    delete st;
+}
+
 void sceadan_clear(sceadan *s)
 {
-    memset(s->v,0,sizeof(sceadan_vectors_t));
+    sceadan_ctx_clear(s->ctx);
 }
 
 void sceadan_update(sceadan *s,const uint8_t *buf,size_t bufsize)
 {
-    vectors_update(s,buf, bufsize, s->v);
+    sceadan_ctx_update(s->ctx,buf,bufsize);
+}
+
+void sceadan_update_zeros(sceadan *s,uint64_t count)
+{
+    sceadan_ctx_update_zeros(s->ctx,count);
 }
 
 int sceadan_classify(sceadan *s)
 {
-    int r = sceadan_predict(s,s->v);
-    sceadan_clear(s);
-    return r;
+    return sceadan_ctx_classify(s->ctx);
+}
+
+int sceadan_classify_all(sceadan *s,int *types)
+{
+    return sceadan_ctx_classify_all(s->ctx,types);
 }
 
 
@@ -938,44 +1803,286 @@ int sceadan_classify_file(const sceadan *s,const char *file_name)
     sceadan_vectors_t v;
     memset(&v,0,sizeof(v));
     v.file_name = file_name;
+    const int ngram_mode = extraction_mode(s);
     const int fd = open(file_name, O_RDONLY|O_BINARY);
     if (fd<0) return -1;                /* error condition */
     while (true) {
         uint8_t    buf[BUFSIZ];
         const ssize_t rd = read (fd, buf, sizeof (buf));
         if(rd<=0) break;
-        vectors_update(s,buf,rd,&v);
+        vectors_update(ngram_mode,buf,rd,&v);
     }
     if(close(fd)<0) return -1;
-    return sceadan_predict(s,&v);
+    const sceadan_ctx ctx(s);
+    return sceadan_predict(&ctx,&v);
+}
+
+/* Early-exit classification of a file prefix.
+ *
+ * The vectors are classified at checkpoints that grow geometrically
+ * from PREFIX_FIRST_CHECKPOINT. Reading stops once the prediction has
+ * the same label at PREFIX_STABLE_CHECKPOINTS consecutive checkpoints
+ * and the margin has moved by less than PREFIX_MARGIN_TOLERANCE
+ * (relative) between the last two, or at end of file.
+ */
+#define PREFIX_FIRST_CHECKPOINT   (64*1024)
+#define PREFIX_GROWTH             4
+#define PREFIX_STABLE_CHECKPOINTS 2
+#define PREFIX_MARGIN_TOLERANCE   (.25)
+#define PREFIX_READ_SIZE          (64*1024)
+
+int sceadan_classify_fd_prefix(const sceadan *s,int fd,int *types,uint64_t *bytes_read)
+{
+    sceadan_vectors_t *v    = new sceadan_vectors_t();
+    sceadan_vectors_t *snap = new sceadan_vectors_t();
+    uint8_t *buf = (uint8_t *)malloc(PREFIX_READ_SIZE);
+    uint64_t total = 0;
+    uint64_t checkpoint = PREFIX_FIRST_CHECKPOINT;
+    int    last_type = -1;
+    double last_margin = 0;
+    int    stable = 0;
+    int    ret = -1;
+    const int ngram_mode = extraction_mode(s);
+    const sceadan_ctx ctx(s);
+
+    if(buf==0) goto done;
+    while(true){
+        size_t want = PREFIX_READ_SIZE;
+        if(checkpoint-total < want) want = checkpoint-total;
+        const ssize_t rd = read(fd, buf, want);
+        if(rd<0) goto done;             /* error condition */
+        if(rd>0){
+            vectors_update(ngram_mode,buf,rd,v);
+            total += rd;
+        }
+        if(rd==0) break;                /* end of file; classify everything */
+        if(total<checkpoint) continue;
+
+        /* At a checkpoint: classify a copy, since finalizing is destructive */
+        *snap = *v;
+        vectors_finalize(snap);
+        double margin = 0;
+        int t;
+        {
+            classifier_guard g(s);
+            t = predict_vectors(&ctx,g[0],snap,&margin);
+        }
+        if(t==last_type &&
+           fabs(margin-last_margin) <= PREFIX_MARGIN_TOLERANCE * fabs(last_margin)){
+            stable++;
+        } else {
+            stable = 1;
+        }
+        last_type   = t;
+        last_margin = margin;
+        if(stable>=PREFIX_STABLE_CHECKPOINTS) break;
+        checkpoint *= PREFIX_GROWTH;
+    }
+    if(types){
+        sceadan_predict_all(&ctx,v,types);
+        ret = types[0];
+    } else {
+        ret = sceadan_predict(&ctx,v);
+    }
+    if(bytes_read) *bytes_read = total;
+done:
+    free(buf);
+    delete snap;
+    delete v;
+    return ret;
+}
+
+/* Ranges of an open fd.
+ *
+ * Regular files are mapped RANGE_MAP_SIZE bytes at a time with
+ * MADV_SEQUENTIAL and the mapping is fed to the vectors directly.
+ * Other files (devices, pipes), and systems without mmap, are read
+ * with pread into a RANGE_READ_SIZE buffer aligned to RANGE_ALIGN.
+ * The fd's file offset is not used or changed.
+ */
+#define RANGE_MAP_SIZE  (64*1024*1024)
+#define RANGE_READ_SIZE (4*1024*1024)
+#define RANGE_ALIGN     4096
+
+template <class F>
+static int fd_range_feed(int fd,uint64_t offset,uint64_t length,F feed)
+{
+    struct stat st;
+    if(fstat(fd,&st)<0) return -1;
+    if(S_ISREG(st.st_mode)){
+        if(offset>=(uint64_t)st.st_size) return 0;
+        if(length>(uint64_t)st.st_size-offset) length = st.st_size-offset;
+#ifdef HAVE_SYS_MMAN_H
+        const uint64_t pagesize = sysconf(_SC_PAGESIZE);
+        while(length>0){
+            const uint64_t start = offset - offset % pagesize;
+            const size_t   skip  = offset - start;
+            const size_t   len   = std::min<uint64_t>(length, RANGE_MAP_SIZE - skip);
+            void *map = mmap(0,skip+len,PROT_READ,MAP_SHARED,fd,start);
+            if(map==MAP_FAILED) break;  // read the rest
+            madvise(map,skip+len,MADV_SEQUENTIAL);
+            feed((const uint8_t *)map+skip,len);
+            munmap(map,skip+len);
+            offset += len;
+            length -= len;
+        }
+        if(length==0) return 0;
+#endif
+    }
+    uint8_t *buf = 0;
+#ifdef HAVE_POSIX_MEMALIGN
+    if(posix_memalign((void **)&buf,RANGE_ALIGN,RANGE_READ_SIZE)!=0) buf = 0;
+#else
+    buf = (uint8_t *)malloc(RANGE_READ_SIZE);
+#endif
+    if(buf==0) return -1;
+    int ret = 0;
+    while(length>0){
+        const size_t want = std::min<uint64_t>(length,RANGE_READ_SIZE);
+#ifdef HAVE_PREAD
+        const ssize_t rd = pread(fd,buf,want,offset);
+#else
+        const ssize_t rd = (lseek(fd,offset,SEEK_SET)<0) ? -1 : read(fd,buf,want);
+#endif
+        if(rd<0){ ret = -1; break; }
+        if(rd==0) break;                /* end of file */
+        feed(buf,rd);
+        offset += rd;
+        length -= rd;
+    }
+    free(buf);
+    return ret;
+}
+
+int sceadan_classify_fd_range(const sceadan *s,int fd,uint64_t offset,uint64_t length)
+{
+    sceadan_vectors_t *v = new sceadan_vectors_t();
+    const int ngram_mode = extraction_mode(s);
+    int ret = fd_range_feed(fd,offset,length,[&](const uint8_t *buf,size_t len){
+            vectors_update(ngram_mode,buf,len,v);
+        });
+    const sceadan_ctx ctx(s);
+    if(ret==0) ret = sceadan_predict(&ctx,v);
+    delete v;
+    return ret;
+}
+
+int sceadan_classify_fd_blocks(const sceadan *s,int fd,uint64_t offset,uint64_t length,size_t block_size,
+                               sceadan_block_cb cb,void *arg)
+{
+    sceadan_stream *st = sceadan_stream_open(s,block_size,cb,arg);
+    if(st==0) return -1;
+    st->offset = offset;
+    int blocks = 0;
+    int ret = fd_range_feed(fd,offset,length,[&](const uint8_t *buf,size_t len){
+            blocks += sceadan_stream_write(st,buf,len);
+        });
+    if(ret==0){
+        blocks += sceadan_stream_finish(st);
+        ret = blocks;
+    }
+    sceadan_stream_close(st);
+    return ret;
+}
+
+int sceadan_classify_file_prefix(const sceadan *s,const char *file_name,uint64_t *bytes_read)
+{
+    const int fd = open(file_name, O_RDONLY|O_BINARY);
+    if (fd<0) return -1;                /* error condition */
+    const int ret = sceadan_classify_fd_prefix(s,fd,0,bytes_read);
+    if(close(fd)<0) return -1;
+    return ret;
 }
 
 int  sceadan_classify_buf(const sceadan *s,const uint8_t *buf,size_t buflen)
 {
     sceadan_vectors_t v;
     memset(&v,0,sizeof(v));
-    vectors_update(s,buf,buflen,&v);
-    return sceadan_predict(s,&v);
+    vectors_update(extraction_mode(s),buf,buflen,&v);
+    const sceadan_ctx ctx(s);
+    return sceadan_predict(&ctx,&v);
+}
+
+/* Dense feature rows, for callers that train or analyze outside
+ * liblinear. Column j holds the j-th feature enabled in the mask of the
+ * primary model; sceadan_feature_indexes() gives its liblinear index.
+ */
+int sceadan_nr_features(const sceadan *s)
+{
+    classifier_guard g(s);
+    const char *mask = g[0]->mask;
+    return std::count(mask,mask+MAX_NR_ATTR,'1');
+}
+
+int sceadan_feature_indexes(const sceadan *s,int *indexes,int n)
+{
+    classifier_guard g(s);
+    const char *mask = g[0]->mask;
+    int col = 0;
+    for(int i=0;i<MAX_NR_ATTR && col<n;i++){
+        if(mask[i]=='1') indexes[col++] = i;
+    }
+    return col;
+}
+
+int sceadan_extract_features(const sceadan *s,const uint8_t *buf,size_t buflen,double *row,int n)
+{
+    sceadan_vectors_t *v = new sceadan_vectors_t();
+    vectors_update(extraction_mode(s),buf,buflen,v);
+    vectors_finalize(v);
+    struct feature_node *x = (struct feature_node *) calloc(MAX_NR_ATTR,sizeof(struct feature_node));
+    int col = 0;
+    {
+        classifier_guard g(s);
+        const sceadan_classifier *c = g[0];
+        build_nodes_from_vectors(c,v,x);
+        /* the nodes are in index order, so merge them with the mask */
+        memset(row,0,n*sizeof(double));
+        const struct feature_node *p = x;
+        for(int i=0;i<MAX_NR_ATTR && col<n;i++){
+            if(c->mask[i]!='1') continue;
+            while(p->index!=-1 && p->index<i) p++;
+            if(p->index==i) row[col] = p->value;
+            col++;
+        }
+    }
+    free(x);
+    delete v;
+    return col;
 }
 
 void sceadan_dump_json_on_classify(sceadan *s,int file_type,FILE *out)
 {
-    s->dump_json = out;
-    s->file_type = file_type;
+    s->ctx->dump_json = out;
+    s->ctx->file_type = file_type;
 }
 
 void sceadan_dump_nodes_on_classify(sceadan *s,int file_type,FILE *out)
 {
-    s->dump_nodes = out;
-    s->file_type = file_type;
+    s->ctx->dump_nodes = out;
+    s->ctx->file_type = file_type;
+}
+
+void sceadan_stats_on_classify(sceadan *s,int file_type)
+{
+    if(s->ctx->stats==0) s->ctx->stats = new feature_stats();
+    s->ctx->stats_type = file_type;
 }
 
+/* Setting the ngram mode changes the classifiers in place; do it before classifying.
+ * It applies to the primary model and to the added models that share its
+ * mode; an added bundle keeps the mode its model was trained with.
+ */
 void sceadan_set_ngram_mode(sceadan *s,int ngram_mode)
 {
-    s->ngram_mode = ngram_mode;
-    // build feature mask if it is not loaded from a file
-    if(s->mask_file==0 || s->mask_file[0]==0){
-        sceadan_initialize_feature_mask(s);
+    for(size_t i=0;i<s->models.size();i++){
+        sceadan_classifier *c = s->models[i];
+        if(i>0 && c->entry && c->entry->bundle) continue;
+        c->ngram_mode = ngram_mode;
+        // build feature mask if it is not loaded from a file
+        if(c->mask_file==0 || c->mask_file[0]==0){
+            sceadan_initialize_feature_mask(c);
+        }
     }
 }
 
@@ -990,23 +2097,26 @@ struct fweight {
 
 int sceadan_reduce_feature(sceadan *s,const char *file_name,int n)
 {
-    if(!s->model){
+    sceadan_classifier *c = s->models[0];
+    if(!c->model){
         fprintf(stderr,"sceadan_reduce_feature cannot run if no model is loaded.\n");
         exit(1);
     }
-    int n_class = get_nr_class(s->model);
-    int n_feature = get_nr_feature(s->model); 
+    int n_class = get_nr_class(c->model);
+    int n_feature = get_nr_feature(c->model); 
     assert(n > 0 && n < n_feature);
 
     // generate feature mask using local index range [0, n_feature)
     int *mask_l = (int *) calloc(n_feature, sizeof(int));
     std::vector<fweight> ws;
+    ws.reserve(n_feature);
     for(int i=0; i<n_class; i++){                           // select feature for each class
         for(int j=0; j<n_feature; j++){                     
-            // s->model->w = [f1_c1, f1_c2, ... f1_cn, f2_c1 ... f2_cn, ... ] 
-            ws.push_back(fweight(j, fabs(s->model->w[ i+j*n_class ])));
+            // c->model->w = [f1_c1, f1_c2, ... f1_cn, f2_c1 ... f2_cn, ... ] 
+            ws.push_back(fweight(j, fabs(c->model->w[ i+j*n_class ])));
         }
-        std::sort(ws.begin(), ws.end(), fweight::comp);
+        // only the top n are needed, not their order
+        std::nth_element(ws.begin(), ws.begin()+n, ws.end(), fweight::comp);
         // union selected features for different classes
         for(int k=0; k<n; k++){
             mask_l[ ws[k].idx ] = 1;
@@ -1021,7 +2131,7 @@ int sceadan_reduce_feature(sceadan *s,const char *file_name,int n)
     int count = 0;  // counting selected features
     int idx_l=0, idx_g=1;
     for(; idx_g<MAX_NR_ATTR; idx_g++){
-        if(s->mask[idx_g]=='1'){
+        if(c->mask[idx_g]=='1'){
             if(mask_l[idx_l]){
                 mask_g[idx_g] = '1';
                 count++;
@@ -1050,10 +2160,343 @@ int sceadan_reduce_feature(sceadan *s,const char *file_name,int n)
         return -1;
     }
     // successfully reduce feature     
-    free(s->mask);
-    s->mask = mask_g;
+    set_own_mask(c,mask_g);
     if(sceadan_dump_feature_mask(s, file_name) < 0){
         return -2;
     }
     return 0;
 }
+
+/* Append the statistics accumulated since sceadan_stats_on_classify().
+ * Each type is written as a block; blocks for the same type, from
+ * this or other runs, are added together when the file is read.
+ */
+int sceadan_save_stats(sceadan *s,const char *file_name)
+{
+    const feature_stats *stats = s->ctx->stats;
+    if(stats==0) return 0;
+    FILE *f = fopen(file_name,"a");
+    if(f==0){
+        perror(file_name);
+        return -1;
+    }
+#ifdef HAVE_FLOCK
+    flock(fileno(f),LOCK_EX);           // training runs are often started in parallel
+#endif
+    for(std::map<int,type_stats>::const_iterator it=stats->types.begin();it!=stats->types.end();++it){
+        const type_stats &ts = it->second;
+        fprintf(f,"sceadan_stats 1 %d %" PRIu64 "\n",it->first,ts.count);
+        for(int i=1;i<MAX_NR_ATTR;i++){
+            if(ts.sumsq[i]>0){
+                fprintf(f,"%d %.17g %.17g\n",i,ts.sum[i],ts.sumsq[i]);
+            }
+        }
+        fprintf(f,"end\n");
+    }
+    fflush(f);
+#ifdef HAVE_FLOCK
+    flock(fileno(f),LOCK_UN);
+#endif
+    if(fclose(f)!=0){
+        perror(file_name);
+        return -1;
+    }
+    return 0;
+}
+
+static int load_stats(feature_stats *fs,const char *file_name)
+{
+    FILE *f = fopen(file_name,"r");
+    if(f==0){
+        perror(file_name);
+        return -1;
+    }
+    char line[256];
+    type_stats *ts = 0;
+    int lineno = 0;
+    while(fgets(line,sizeof(line),f)){
+        lineno++;
+        int version=0, type=0, idx=0;
+        uint64_t count=0;
+        double sum=0, sumsq=0;
+        if(ts==0){
+            if(sscanf(line,"sceadan_stats %d %d %" SCNu64,&version,&type,&count)!=3 || version!=1) goto bad;
+            ts = &fs->types[type];
+            ts->count += count;
+        } else if(strncmp(line,"end",3)==0){
+            ts = 0;
+        } else {
+            if(sscanf(line,"%d %lf %lf",&idx,&sum,&sumsq)!=3 || idx<1 || idx>=MAX_NR_ATTR) goto bad;
+            ts->sum[idx]   += sum;
+            ts->sumsq[idx] += sumsq;
+        }
+    }
+    fclose(f);
+    return 0;
+ bad:
+    fprintf(stderr,"sceadan: %s:%d: invalid statistics\n",file_name,lineno);
+    fclose(f);
+    return -1;
+}
+
+/* One-way ANOVA F of feature idx between the types */
+static double anova_f(const feature_stats *fs,int idx,uint64_t n)
+{
+    size_t k = fs->types.size();
+    if(k<2 || n<=k) return 0;
+    double sum = 0, ss_total = 0, ss_types = 0;
+    for(std::map<int,type_stats>::const_iterator it=fs->types.begin();it!=fs->types.end();++it){
+        const type_stats &ts = it->second;
+        if(ts.count==0) continue;
+        sum      += ts.sum[idx];
+        ss_total += ts.sumsq[idx];
+        ss_types += ts.sum[idx] * ts.sum[idx] / ts.count;
+    }
+    double between = ss_types - sum * sum / n;
+    double within  = ss_total - ss_types;
+    if(between<=0) return 0;
+    if(within<=0) return HUGE_VAL;     // perfectly separates the types
+    return (between / (k-1)) / (within / (n-k));
+}
+
+/* Chi-square of the per-type totals of feature idx against the totals
+ * expected from the type frequencies. Feature values are non-negative.
+ */
+static double chi2(const feature_stats *fs,int idx,uint64_t n)
+{
+    double sum = 0;
+    for(std::map<int,type_stats>::const_iterator it=fs->types.begin();it!=fs->types.end();++it){
+        sum += it->second.sum[idx];
+    }
+    if(sum<=0) return 0;
+    double score = 0;
+    for(std::map<int,type_stats>::const_iterator it=fs->types.begin();it!=fs->types.end();++it){
+        double expected = sum * it->second.count / n;
+        if(expected<=0) continue;
+        double d = it->second.sum[idx] - expected;
+        score += d * d / expected;
+    }
+    return score;
+}
+
+int sceadan_select_features(sceadan *s,const char *stats_file,const char *file_name,int n,int method)
+{
+    assert(n > 0);
+    feature_stats fs;
+    if(load_stats(&fs,stats_file)<0) return -2;
+
+    uint64_t total = 0;
+    for(std::map<int,type_stats>::const_iterator it=fs.types.begin();it!=fs.types.end();++it){
+        total += it->second.count;
+    }
+    if(fs.types.size()<2){
+        fprintf(stderr,"sceadan: %s: need statistics for at least two types\n",stats_file);
+        return -2;
+    }
+
+    // score every feature that was ever non-zero
+    std::vector<fweight> ws;
+    for(int i=1;i<MAX_NR_ATTR;i++){
+        bool seen = false;
+        for(std::map<int,type_stats>::const_iterator it=fs.types.begin();it!=fs.types.end() && !seen;++it){
+            seen = it->second.sumsq[i]>0;
+        }
+        if(!seen) continue;
+        double score = (method==SCEADAN_SELECT_CHI2) ? chi2(&fs,i,total) : anova_f(&fs,i,total);
+        ws.push_back(fweight(i, std::isnan(score) ? 0 : score)); // NaN ranks last
+    }
+    int n_feature = ws.size();
+    if(n < n_feature){
+        std::nth_element(ws.begin(), ws.begin()+n, ws.end(), fweight::comp);
+        ws.erase(ws.begin()+n, ws.end());
+    }
+
+    char *mask_g = (char *) malloc(MAX_NR_ATTR*sizeof(char));
+    memset(mask_g, '0', MAX_NR_ATTR);
+    for(size_t k=0;k<ws.size();k++){
+        mask_g[ ws[k].idx ] = '1';
+    }
+    int count = ws.size();
+
+    printf("**********************************************************\n");
+    printf("Feature selection (%s):\n", method==SCEADAN_SELECT_CHI2 ? "chi-square" : "ANOVA F");
+    printf("    n = %d\n", n );
+    printf("    types              = %d\n", int(fs.types.size()) );
+    printf("    vectors            = %" PRIu64 "\n", total );
+    printf("    nr_feature(before) = %d\n", n_feature );
+    printf("    nr_feature(after)  = %d\n", count );
+    printf("**********************************************************\n");
+
+    if(count==n_feature){
+        // select no fewer features; as with sceadan_reduce_feature the caller decreases n
+        free(mask_g);
+        return -1;
+    }
+    sceadan_classifier *c = s->models[0];
+    set_own_mask(c,mask_g);
+    if(sceadan_dump_feature_mask(s, file_name) < 0){
+        return -2;
+    }
+    return 0;
+}
+
+/****************************************************************
+ *** Online model updates
+ ****************************************************************/
+
+/* Read one line of the dump_nodes format ("type index:value ...") into
+ * x, which ends with index -1. Indexes above nr_feature are dropped,
+ * as predict() ignores them, and so is a bias node already in the line.
+ * Returns false at the end of the file or on a malformed line.
+ */
+static bool read_nodes(FILE *f,int nr_feature,int *type,std::vector<feature_node> &x,bool *bad)
+{
+    std::string line;
+    char buf[65536];
+    while(fgets(buf,sizeof(buf),f)){
+        line += buf;
+        if(line[line.size()-1]=='\n') break;
+    }
+    *bad = false;
+    if(line.empty()) return false;
+
+    x.clear();
+    const char *p = line.c_str();
+    char *end = 0;
+    *type = strtol(p,&end,10);
+    if(end==p){ *bad = true; return false; }
+    p = end;
+    while(true){
+        while(*p==' ' || *p=='\t') p++;
+        if(*p=='\n' || *p=='\r' || *p==0) break;
+        feature_node n;
+        n.index = strtol(p,&end,10);
+        if(end==p || *end!=':'){ *bad = true; return false; }
+        p = end+1;
+        n.value = strtod(p,&end);
+        if(end==p){ *bad = true; return false; }
+        p = end;
+        if(n.index>=1 && n.index<=nr_feature) x.push_back(n);
+    }
+    return true;
+}
+
+/* One pass of multi-class passive-aggressive learning (PA-I) over the
+ * vectors in f, starting from model. Every model is treated as one
+ * weight vector per class and the prediction is the class with the
+ * largest score, which is how liblinear predicts; a two-class model
+ * with one weight vector w starts as (w,-w) and is folded back at the
+ * end. On a margin violation the weights of the true class and of the
+ * best wrong class move toward and away from x, by at most C.
+ *
+ * Types not in the model are added as classes with zero weights.
+ * With average, the result is the average of the weights after each
+ * vector, which is less sensitive to the order of the vectors.
+ *
+ * Returns a new model, to be freed with free_and_destroy_model(), or 0.
+ */
+struct model *sceadan_model_update(const struct model *model,FILE *f,double C,int average,
+                                   uint64_t *nr_vectors,uint64_t *nr_mistakes)
+{
+    const int w_size = model_w_size(model);
+    const int nr_w   = model_nr_w(model);
+    std::vector<int> labels(model->label,model->label+model->nr_class);
+
+    /* column k of row i holds the weight of feature i+1 for labels[k] */
+    int K = labels.size();
+    std::vector<double> w(w_size*K), u;
+    for(int i=0;i<w_size;i++){
+        for(int k=0;k<K;k++){
+            w[i*K+k] = (nr_w==1) ? (k==0 ? 1 : -1) * model->w[i] : model->w[i*nr_w+k];
+        }
+    }
+    if(average) u.resize(w.size());
+    double c = 1;                       // steps, for averaging
+
+    uint64_t count = 0, mistakes = 0;
+    std::vector<feature_node> x;
+    std::vector<double> score;
+    int type = 0;
+    bool bad = false;
+    while(read_nodes(f,model->nr_feature,&type,x,&bad)){
+        if(model->bias>=0){
+            feature_node b;
+            b.index = model->nr_feature+1;
+            b.value = model->bias;
+            x.push_back(b);
+        }
+        int y = std::find(labels.begin(),labels.end(),type) - labels.begin();
+        if(y==K){                       // a new class: add a column of zeros
+            std::vector<double> w2(w_size*(K+1)), u2(average ? w2.size() : 0);
+            for(int i=0;i<w_size;i++){
+                std::copy(&w[i*K],&w[i*K]+K,&w2[i*(K+1)]);
+                if(average) std::copy(&u[i*K],&u[i*K]+K,&u2[i*(K+1)]);
+            }
+            w.swap(w2);
+            u.swap(u2);
+            labels.push_back(type);
+            K++;
+        }
+
+        score.assign(K,0);
+        double norm2 = 0;
+        for(size_t j=0;j<x.size();j++){
+            const double *wi = &w[(x[j].index-1)*K];
+            for(int k=0;k<K;k++) score[k] += wi[k]*x[j].value;
+            norm2 += x[j].value*x[j].value;
+        }
+        int r = (y==0) ? 1 : 0;         // best wrong class
+        for(int k=0;k<K;k++){
+            if(k!=y && score[k]>score[r]) r = k;
+        }
+        count++;
+        if(score[r]>=score[y]) mistakes++;
+
+        double loss = 1 - (score[y]-score[r]);
+        if(loss>0 && norm2>0){
+            double tau = std::min(C, loss/(2*norm2));
+            for(size_t j=0;j<x.size();j++){
+                double d = tau * x[j].value;
+                double *wi = &w[(x[j].index-1)*K];
+                wi[y] += d;
+                wi[r] -= d;
+                if(average){
+                    double *ui = &u[(x[j].index-1)*K];
+                    ui[y] += c*d;
+                    ui[r] -= c*d;
+                }
+            }
+        }
+        c++;
+    }
+    if(bad){
+        fprintf(stderr,"sceadan: invalid vector after %" PRIu64 " vectors\n",count);
+        return 0;
+    }
+    if(average){
+        for(size_t i=0;i<w.size();i++) w[i] -= u[i]/c;
+    }
+
+    struct model *m = (struct model *)calloc(1,sizeof(struct model));
+    m->param             = model->param;
+    m->param.nr_weight   = 0;
+    m->param.weight_label = 0;
+    m->param.weight      = 0;
+    m->nr_class   = K;
+    m->nr_feature = model->nr_feature;
+    m->bias       = model->bias;
+    m->label      = (int *)malloc(K*sizeof(int));
+    std::copy(labels.begin(),labels.end(),m->label);
+    const int nr_w2 = model_nr_w(m);
+    m->w = (double *)malloc((size_t)w_size*nr_w2*sizeof(double));
+    for(int i=0;i<w_size;i++){
+        if(nr_w2==1){
+            m->w[i] = (w[i*K] - w[i*K+1]) / 2;
+        } else {
+            std::copy(&w[i*K],&w[i*K]+K,&m->w[i*nr_w2]);
+        }
+    }
+    if(nr_vectors)  *nr_vectors = count;
+    if(nr_mistakes) *nr_mistakes = mistakes;
+    return m;
+}
@@ -12,13 +12,18 @@ __BEGIN_DECLS
 struct model;                           // in liblinear
 
 typedef struct sceadan_t sceadan;
+typedef struct sceadan_ctx_t sceadan_ctx;    // per-stream state; see sceadan_ctx_open()
 
 /* struct model is defined in liblinear. If you don't have it, it
  * won't generate an error unless it's used (and it won't be).
  */
 
 void sceadan_model_dump(const struct model *,FILE *outfile); // to stdout
-sceadan *sceadan_open(const char *model_file,                // liblinear file
+int  sceadan_model_save_blob(const struct model *,FILE *outfile); // binary form for linking into the program
+int  sceadan_model_from_blob(struct model *,const void *blob,size_t len); // points the model into the blob
+struct model *sceadan_model_update(const struct model *,FILE *vectors,double C,int average,
+                                   uint64_t *nr_vectors,uint64_t *nr_mistakes); // online pass over dumped vectors; returns a new model
+sceadan *sceadan_open(const char *model_file,                // liblinear file or bundle
                       const char *class_file,                // list of lines with additional classes
                       const char *feature_mask_file); // array of 0s and 1s with which features to use
 
@@ -26,20 +31,67 @@ const struct model *sceadan_model_precompiled(void);
 const struct model *sceadan_model_default(void); // from a file
 const char *sceadan_model_name(sceadan *s);
 void sceadan_update(sceadan *,const uint8_t *buf,size_t bufsize);
+void sceadan_update_zeros(sceadan *,uint64_t count); // as sceadan_update() with count zero bytes, without scanning them
 void sceadan_clear(sceadan *s);         // like a close and open
 int sceadan_classify(sceadan *);
+int sceadan_classify_all(sceadan *,int *types); // classify with every model; types[] needs sceadan_nr_models() entries
+
+/* A context holds the vectors of one stream and only reads the handle,
+ * so N threads can classify against one handle with N contexts.
+ * Close the contexts before the handle. Contexts do not dump vectors.
+ */
+sceadan_ctx *sceadan_ctx_open(const sceadan *);
+void sceadan_ctx_close(sceadan_ctx *);
+void sceadan_ctx_update(sceadan_ctx *,const uint8_t *buf,size_t bufsize);
+void sceadan_ctx_update_zeros(sceadan_ctx *,uint64_t count);
+void sceadan_ctx_clear(sceadan_ctx *);
+int sceadan_ctx_classify(sceadan_ctx *);
+int sceadan_ctx_classify_all(sceadan_ctx *,int *types);
+
+/* A stream cuts the chunks written to it into blocks of block_size
+ * bytes and calls cb for each block with its offset, the type from the
+ * primary model and the decision margin as a score. Chunks can be of
+ * any size and are not copied. sceadan_stream_finish() reports the
+ * final partial block, if any, and starts over at offset 0.
+ * Each returns the number of blocks reported.
+ */
+typedef struct sceadan_stream_t sceadan_stream;
+typedef void (*sceadan_block_cb)(void *arg,uint64_t offset,int type,double score);
+sceadan_stream *sceadan_stream_open(const sceadan *,size_t block_size,sceadan_block_cb cb,void *arg);
+int sceadan_stream_write(sceadan_stream *,const uint8_t *buf,size_t len);
+int sceadan_stream_finish(sceadan_stream *);
+void sceadan_stream_close(sceadan_stream *);
+int sceadan_classify_fd_blocks(const sceadan *,int fd,uint64_t offset,uint64_t length,size_t block_size,
+                               sceadan_block_cb cb,void *arg); // every block of a range, as a stream would; returns blocks or -1
+
 int sceadan_classify_file(const sceadan *,const char *fname);    // classify a file
 int  sceadan_classify_buf(const sceadan *s,const uint8_t *buf,size_t buflen);
+int sceadan_nr_features(const sceadan *s);                  // columns of a sceadan_extract_features() row
+int sceadan_feature_indexes(const sceadan *s,int *indexes,int n); // liblinear index of each column
+int sceadan_extract_features(const sceadan *s,const uint8_t *buf,size_t buflen,double *row,int n); // dense feature row
+int sceadan_classify_fd_prefix(const sceadan *,int fd,int *types,uint64_t *bytes_read); // stop reading once the prediction is stable
+int sceadan_classify_file_prefix(const sceadan *,const char *fname,uint64_t *bytes_read);
+int sceadan_classify_fd_range(const sceadan *,int fd,uint64_t offset,uint64_t length); // length is clamped to the end of the file
 const char *sceadan_name_for_type(const sceadan *,int type);
+const char *sceadan_name_for_model_type(const sceadan *,int model,int type); // names for added models
 int sceadan_type_for_name(const sceadan *,const char *name);
 void sceadan_close(sceadan *);
+int sceadan_add_model(sceadan *,const char *model_file,const char *class_file,const char *feature_mask_file); // returns model index
+int sceadan_nr_models(const sceadan *s);                    // primary model plus added models
+int sceadan_reload(sceadan *,int model,const char *model_file,const char *class_file,const char *feature_mask_file); // swap model (0 is primary) while classifying
 void sceadan_dump_json_on_classify(sceadan *,int file_type,FILE *out); // dump JSON vectors instead of classifying
 void sceadan_dump_nodes_on_classify(sceadan *,int file_type,FILE *out); // dump  vectors instead of classifying
-void sceadan_set_ngram_mode(sceadan *s,int mode);
+void sceadan_set_ngram_mode(sceadan *s,int mode);        // primary model, and added models that are not bundles
 void sceadan_build_feature_mask(sceadan *s);
 int sceadan_load_feature_mask(sceadan *s,const char *file_name);
 int sceadan_dump_feature_mask(sceadan *s,const char *file_name);
+int sceadan_save_bundle(const sceadan *s,const char *file_name); // model, types, mask and ngram_mode in one mappable file
 int sceadan_reduce_feature(sceadan *s,const char *file_name,int n); // select top n features for each type, and dump resulted feature mask to a file
+void sceadan_stats_on_classify(sceadan *,int file_type);    // accumulate per-type feature statistics of classified vectors
+int sceadan_save_stats(sceadan *s,const char *file_name);   // append the statistics to a file; runs are merged when it is read
+#define SCEADAN_SELECT_ANOVA_F 0
+#define SCEADAN_SELECT_CHI2    1
+int sceadan_select_features(sceadan *s,const char *stats_file,const char *file_name,int n,int method); // select top n features by a statistic, and dump resulted feature mask to a file
 
 #define SCEADAN_NGRAM_MODE_DEFAULT 2
 
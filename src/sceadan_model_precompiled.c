@@ -2,13 +2,80 @@
 #include "../liblinear/linear.h"
 #include "sceadan.h"
 
-#ifdef HAVE_SRC_SCEADAN_MODEL_PRECOMPILED_DAT
+/*
+ * The precompiled model is preferably a binary blob written by
+ * "mcompile -b" and linked in with .incbin, so that nothing needs to
+ * be compiled or parsed. SCEADAN_MODEL_BLOB is its absolute path and
+ * is provided by the Makefile.
+ */
+
+#if defined(HAVE_SRC_SCEADAN_MODEL_PRECOMPILED_BIN) && defined(SCEADAN_MODEL_BLOB)
+#define HAVE_MODEL
+#include <pthread.h>
+
+#define SCEADAN_STR2(x) #x
+#define SCEADAN_STR(x)  SCEADAN_STR2(x)
+#ifdef __USER_LABEL_PREFIX__
+#define SCEADAN_SYM(name) SCEADAN_STR(__USER_LABEL_PREFIX__) #name
+#else
+#define SCEADAN_SYM(name) #name
+#endif
+
+/* On ELF the symbols are typed and sized as data objects, so that
+ * debuggers, size tools and LTO see the blob as an object.
+ */
+#if defined(__APPLE__)
+#define SCEADAN_BLOB_SECTION ".const_data"
+#define SCEADAN_BLOB_OBJECT(name,size) ""
+#elif defined(_WIN32)
+#define SCEADAN_BLOB_SECTION ".section .rdata,\"dr\""
+#define SCEADAN_BLOB_OBJECT(name,size) ""
+#else
+#define SCEADAN_BLOB_SECTION ".section .rodata"
+#define SCEADAN_BLOB_OBJECT(name,size) ".type " SCEADAN_SYM(name) ",%object\n" \
+                                       ".size " SCEADAN_SYM(name) "," size "\n"
+#endif
+
+__asm__(SCEADAN_BLOB_SECTION "\n"
+        ".balign 16\n"
+        SCEADAN_BLOB_OBJECT(sceadan_model_blob,
+                            SCEADAN_SYM(sceadan_model_blob_end) "-" SCEADAN_SYM(sceadan_model_blob))
+        SCEADAN_SYM(sceadan_model_blob) ":\n"
+        ".incbin \"" SCEADAN_MODEL_BLOB "\"\n"
+        SCEADAN_BLOB_OBJECT(sceadan_model_blob_end,"1")
+        SCEADAN_SYM(sceadan_model_blob_end) ":\n"
+        ".byte 0\n"
+        ".text\n");
+
+extern const unsigned char sceadan_model_blob[];
+extern const unsigned char sceadan_model_blob_end[];
+
+/* The blob is checked once, by whichever thread opens a sceadan first */
+static struct model precompiled_model;
+static const struct model *precompiled = 0;
+static pthread_once_t precompiled_once = PTHREAD_ONCE_INIT;
+
+static void precompiled_load(void)
+{
+    if(sceadan_model_from_blob(&precompiled_model,sceadan_model_blob,sceadan_model_blob_end-sceadan_model_blob)==0){
+        precompiled = &precompiled_model;
+    }
+}
+
+const struct model *sceadan_model_precompiled()
+{
+    pthread_once(&precompiled_once,precompiled_load);
+    return precompiled;
+}
+
+/* Older builds compiled the model from C source generated by mcompile */
+#elif defined(HAVE_SRC_SCEADAN_MODEL_PRECOMPILED_DAT)
 #  include "sceadan_model_precompiled.dat"
 #define HAVE_MODEL
 #endif
 
 
-#ifdef HAVE_SCEADAN_SRC_SCEADAN_MODEL_PRECOMPILED_DAT
+#if !defined(HAVE_MODEL) && defined(HAVE_SCEADAN_SRC_SCEADAN_MODEL_PRECOMPILED_DAT)
 #  include "sceadan/src/sceadan_model_precompiled.dat"
 #define HAVE_MODEL
 #endif
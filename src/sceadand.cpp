@@ -0,0 +1,548 @@
+//===============================================================================================================//
+
+//Copyright (c) 2012-2013 The University of Texas at San Antonio
+
+//This program is free software; you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation; either version 2 of the License, or (at your option) any later version.
+
+//This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Public License for more details.
+
+//You should have received a copy of the GNU General Public License along with this program; if not, write to the Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+//Written by:
+//Dr. Nicole Beebe and Lishu Liu, Department of Information Systems and Cyber Security (nicole.beebe@utsa.edu)
+//Laurence Maddox, Department of Computer Science
+//University of Texas at San Antonio
+//One UTSA Circle
+//San Antonio, Texas 78209
+
+//===============================================================================================================//
+
+
+
+#include "config.h"
+
+#ifndef __STDC_FORMAT_MACROS
+#define __STDC_FORMAT_MACROS
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dig.h"
+#include "sceadan.h"
+#include "sceadand.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/*
+ * sceadand keeps a model loaded and classifies for clients on a Unix
+ * domain socket, so short-lived callers do not pay for opening the
+ * model. The wire format is in sceadand.h. With -c, sceadand is also
+ * the client: it sends files as ranges and prints what sceadan_app
+ * would.
+ */
+
+#define CLIENT_BATCH 64                 /* files sent in one request */
+
+static volatile sig_atomic_t stopping = 0;
+
+static void on_signal(int)
+{
+    stopping = 1;
+}
+
+/* Read or write exactly len bytes. read_full returns 0 at a clean end of file. */
+static int read_full(int fd,void *buf_,size_t len)
+{
+    uint8_t *buf = (uint8_t *)buf_;
+    size_t got = 0;
+    while(got<len){
+        ssize_t rd = read(fd,buf+got,len-got);
+        if(rd<0 && errno==EINTR) continue;
+        if(rd<0) return -1;
+        if(rd==0){
+            if(got==0) return 0;
+            errno = EPIPE;
+            return -1;
+        }
+        got += rd;
+    }
+    return 1;
+}
+
+static int write_full(int fd,const void *buf_,size_t len)
+{
+    const uint8_t *buf = (const uint8_t *)buf_;
+    while(len>0){
+        ssize_t wr = write(fd,buf,len);
+        if(wr<0 && errno==EINTR) continue;
+        if(wr<0) return -1;
+        buf += wr;
+        len -= wr;
+    }
+    return 0;
+}
+
+static int socket_address(const char *path,struct sockaddr_un *sun)
+{
+    memset(sun,0,sizeof(*sun));
+    sun->sun_family = AF_UNIX;
+    if(strlen(path)>=sizeof(sun->sun_path)){
+        fprintf(stderr,"sceadand: socket path too long: %s\n",path);
+        return -1;
+    }
+    strcpy(sun->sun_path,path);
+    return 0;
+}
+
+static int connect_socket(const char *path)
+{
+    struct sockaddr_un sun;
+    if(socket_address(path,&sun)<0) return -1;
+    int fd = socket(AF_UNIX,SOCK_STREAM,0);
+    if(fd<0) return -1;
+    if(connect(fd,(struct sockaddr *)&sun,sizeof(sun))<0){
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/****************************************************************
+ *** Server
+ ****************************************************************/
+
+static const sceadan *s = 0;
+
+struct result_sink {
+    std::vector<sceadand_result> *results;
+    uint32_t item;
+    uint64_t base;                      /* added to the offsets of a buffer's blocks */
+    int      reported;
+};
+
+static void add_result(void *arg,uint64_t offset,int type,double score)
+{
+    result_sink *rs = (result_sink *)arg;
+    sceadand_result r;
+    memset(&r,0,sizeof(r));
+    r.offset = rs->base + offset;
+    r.item   = rs->item;
+    r.type   = type;
+    r.score  = score;
+    rs->results->push_back(r);
+    rs->reported++;
+}
+
+static void classify_buffer(const sceadand_item &it,const uint8_t *data,result_sink *rs)
+{
+    uint64_t size = it.size;
+    if(it.block_size && (it.flags & SCEADAND_FULL_BLOCKS)) size -= size % it.block_size;
+    sceadan_stream *st = sceadan_stream_open(s,it.block_size ? it.block_size : SIZE_MAX,add_result,rs);
+    if(st==0){
+        add_result(rs,0,-1,ENOMEM);
+        return;
+    }
+    sceadan_stream_write(st,data,size);
+    sceadan_stream_finish(st);
+    sceadan_stream_close(st);
+}
+
+static void classify_range(const sceadand_item &it,const std::string &path,result_sink *rs)
+{
+    if(path.find('\0')!=std::string::npos){
+        add_result(rs,it.offset,-1,EINVAL);
+        return;
+    }
+    const int fd = open(path.c_str(),O_RDONLY|O_BINARY);
+    if(fd<0){
+        add_result(rs,it.offset,-1,errno);
+        return;
+    }
+    uint64_t length = it.length;
+    struct stat st;
+    if(it.block_size && (it.flags & SCEADAND_FULL_BLOCKS) && fstat(fd,&st)==0 && S_ISREG(st.st_mode)){
+        const uint64_t size = st.st_size;
+        if(it.offset>=size) length = 0;
+        else if(length>size-it.offset) length = size-it.offset;
+        length -= length % it.block_size;
+    }
+    if(length>0 &&
+       sceadan_classify_fd_blocks(s,fd,it.offset,length,it.block_size ? it.block_size : SIZE_MAX,add_result,rs)<0){
+        add_result(rs,it.offset,-1,errno);
+    }
+    close(fd);
+}
+
+/* Answer requests on one connection until the client closes it.
+ * A malformed request is answered with its errno and ends the connection,
+ * since the rest of the stream can no longer be framed.
+ */
+static void serve_connection(int fd)
+{
+    std::vector<sceadand_result> results;
+    std::vector<uint8_t> data;
+    while(!stopping){
+        sceadand_request req;
+        if(read_full(fd,&req,sizeof(req))<=0) break;
+        int status = 0;
+        if(req.magic!=SCEADAND_MAGIC || req.version!=SCEADAND_VERSION) status = EPROTO;
+        else if(req.count>SCEADAND_MAX_ITEMS) status = E2BIG;
+        results.clear();
+        for(uint32_t i=0;i<req.count && status==0;i++){
+            sceadand_item it;
+            if(read_full(fd,&it,sizeof(it))<=0){ status = EPIPE; break; }
+            if(it.size>SCEADAND_MAX_SIZE){ status = EFBIG; break; }
+            data.resize(it.size);
+            if(it.size>0 && read_full(fd,&data[0],it.size)<=0){ status = EPIPE; break; }
+            result_sink rs = {&results,i,it.kind==SCEADAND_BUFFER ? it.offset : 0,0};
+            switch(it.kind){
+            case SCEADAND_BUFFER:
+                classify_buffer(it,data.empty() ? 0 : &data[0],&rs);
+                break;
+            case SCEADAND_RANGE:
+                classify_range(it,std::string(data.begin(),data.end()),&rs);
+                break;
+            default:
+                add_result(&rs,it.offset,-1,EINVAL);
+            }
+            /* An item classified as a whole always has a type, even when empty */
+            if(it.block_size==0 && rs.reported==0){
+                add_result(&rs,it.kind==SCEADAND_RANGE ? it.offset : 0,sceadan_classify_buf(s,0,0),0);
+            }
+        }
+        if(status) results.clear();
+        sceadand_response resp;
+        memset(&resp,0,sizeof(resp));
+        resp.magic   = SCEADAND_MAGIC;
+        resp.version = SCEADAND_VERSION;
+        resp.count   = results.size();
+        resp.status  = status;
+        if(write_full(fd,&resp,sizeof(resp))<0) break;
+        if(results.size()>0 &&
+           write_full(fd,&results[0],results.size()*sizeof(sceadand_result))<0) break;
+        if(status) break;
+    }
+    close(fd);
+}
+
+/* Connections wait here for a worker. The pool is never destroyed:
+ * the workers are still waiting on it when main() returns.
+ */
+struct connection_pool {
+    connection_pool():mutex(),cv(),fds(){}
+    std::mutex              mutex;
+    std::condition_variable cv;
+    std::deque<int>         fds;
+};
+static connection_pool *pool = new connection_pool();
+
+static void worker()
+{
+    while(true){
+        int fd;
+        {
+            std::unique_lock<std::mutex> lock(pool->mutex);
+            pool->cv.wait(lock,[]{ return !pool->fds.empty(); });
+            fd = pool->fds.front();
+            pool->fds.pop_front();
+        }
+        serve_connection(fd);
+    }
+}
+
+/* Whether the process at the other end of fd runs as our user */
+static bool peer_is_owner(int fd)
+{
+#if defined(SO_PEERCRED)
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    return getsockopt(fd,SOL_SOCKET,SO_PEERCRED,&cred,&len)==0 && cred.uid==geteuid();
+#elif defined(HAVE_GETPEEREID)
+    uid_t uid;
+    gid_t gid;
+    return getpeereid(fd,&uid,&gid)==0 && uid==geteuid();
+#else
+    (void)fd;
+    return true;                        /* the 0600 socket is the only check */
+#endif
+}
+
+static int run_server(const char *path,int workers)
+{
+    struct sockaddr_un sun;
+    if(socket_address(path,&sun)<0) return -1;
+
+    /* Take over a stale socket, but not one with a daemon behind it */
+    int probe = connect_socket(path);
+    if(probe>=0){
+        close(probe);
+        fprintf(stderr,"sceadand: a daemon is already listening on %s\n",path);
+        return -1;
+    }
+    unlink(path);
+
+    /* The daemon reads any file a client names, so only its own user
+     * may connect: the socket is created 0600, and peers are checked.
+     */
+    int lfd = socket(AF_UNIX,SOCK_STREAM,0);
+    const mode_t old_umask = umask(077);
+    const int bound = lfd<0 ? -1 : bind(lfd,(struct sockaddr *)&sun,sizeof(sun));
+    umask(old_umask);
+    if(lfd<0 || bound<0 || chmod(path,0600)<0 || listen(lfd,SOMAXCONN)<0){
+        perror(path);
+        return -1;
+    }
+
+    struct sigaction sa;
+    memset(&sa,0,sizeof(sa));
+    sa.sa_handler = on_signal;          /* no SA_RESTART, so accept() returns */
+    sigaction(SIGINT,&sa,0);
+    sigaction(SIGTERM,&sa,0);
+    signal(SIGPIPE,SIG_IGN);
+
+    /* The workers block the signals so that they reach accept() */
+    sigset_t mask,old;
+    sigemptyset(&mask);
+    sigaddset(&mask,SIGINT);
+    sigaddset(&mask,SIGTERM);
+    pthread_sigmask(SIG_BLOCK,&mask,&old);
+    for(int i=0;i<workers;i++){
+        std::thread(worker).detach();
+    }
+    pthread_sigmask(SIG_SETMASK,&old,0);
+    while(!stopping){
+        int fd = accept(lfd,0,0);
+        if(fd<0){
+            if(errno==EINTR || errno==ECONNABORTED) continue;
+            perror("accept");
+            break;
+        }
+        if(!peer_is_owner(fd)){
+            fprintf(stderr,"sceadand: refused a connection from another user\n");
+            close(fd);
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        pool->fds.push_back(fd);
+        pool->cv.notify_one();
+    }
+    close(lfd);
+    unlink(path);
+    return 0;
+}
+
+/****************************************************************
+ *** Client
+ ****************************************************************/
+
+struct client_file {
+    client_file():path(),data(){}
+    std::string          path;
+    std::vector<uint8_t> data;          /* stdin is sent as a buffer */
+};
+
+static int opt_client_blocks = 0;
+static uint32_t opt_client_block_size = 512;
+static int opt_client_omit = 0;
+static int client_failures = 0;         /* items the daemon could not classify */
+
+/* Send one batch and print the results as sceadan_app does */
+static int client_batch(int fd,const sceadan *names,const std::vector<client_file> &files)
+{
+    std::vector<uint8_t> req(sizeof(sceadand_request));
+    sceadand_request hdr;
+    memset(&hdr,0,sizeof(hdr));
+    hdr.magic   = SCEADAND_MAGIC;
+    hdr.version = SCEADAND_VERSION;
+    hdr.count   = files.size();
+    memcpy(&req[0],&hdr,sizeof(hdr));
+    for(size_t i=0;i<files.size();i++){
+        const client_file &f = files[i];
+        sceadand_item it;
+        memset(&it,0,sizeof(it));
+        it.block_size = opt_client_blocks ? opt_client_block_size : 0;
+        it.flags      = SCEADAND_FULL_BLOCKS;
+        if(f.path=="-"){
+            it.kind   = SCEADAND_BUFFER;
+        } else {
+            it.kind   = SCEADAND_RANGE;
+            it.offset = opt_client_omit ? opt_client_block_size : 0;
+            it.length = SCEADAND_TO_END;
+            it.size   = f.path.size();
+        }
+        const uint8_t *p = (const uint8_t *)&it;
+        if(f.path=="-"){
+            /* -x drops the first block here; offset numbers what is left */
+            const size_t skip = opt_client_omit ? std::min<size_t>(opt_client_block_size,f.data.size()) : 0;
+            it.offset = skip;
+            it.size   = f.data.size()-skip;
+            req.insert(req.end(),p,p+sizeof(it));
+            req.insert(req.end(),f.data.begin()+skip,f.data.end());
+        } else {
+            req.insert(req.end(),p,p+sizeof(it));
+            req.insert(req.end(),f.path.begin(),f.path.end());
+        }
+    }
+    if(write_full(fd,&req[0],req.size())<0){
+        perror("sceadand: write");
+        return -1;
+    }
+    sceadand_response resp;
+    if(read_full(fd,&resp,sizeof(resp))<=0 || resp.magic!=SCEADAND_MAGIC){
+        fprintf(stderr,"sceadand: no response from the daemon\n");
+        return -1;
+    }
+    if(resp.status){
+        fprintf(stderr,"sceadand: request refused: %s\n",strerror(resp.status));
+        return -1;
+    }
+    for(uint32_t i=0;i<resp.count;i++){
+        sceadand_result r;
+        if(read_full(fd,&r,sizeof(r))<=0){
+            fprintf(stderr,"sceadand: short response\n");
+            return -1;
+        }
+        if(r.item>=files.size()){
+            fprintf(stderr,"sceadand: bad item in response\n");
+            return -1;
+        }
+        const client_file &f = files[r.item];
+        if(r.type<0){
+            fprintf(stderr,"cannot open %s: %s\n",f.path.c_str(),strerror((int)r.score));
+            client_failures++;
+            continue;
+        }
+        const uint64_t offset = opt_client_blocks ? r.offset : 0;
+        printf("%-10" PRId64 " %s # %s\n",offset,sceadan_name_for_type(names,r.type),f.path.c_str());
+    }
+    return 0;
+}
+
+static int run_client(const char *path,const sceadan *names,int argc,char **argv)
+{
+    int fd = connect_socket(path);
+    if(fd<0){
+        perror(path);
+        return -1;
+    }
+    std::vector<client_file> batch;
+    int ret = 0;
+    for(int i=0;i<argc && ret==0;i++){
+        if(strcmp(argv[i],"-")==0){
+            client_file f;
+            f.path = "-";
+            uint8_t buf[65536];
+            ssize_t rd;
+            while((rd=read(STDIN_FILENO,buf,sizeof(buf)))>0) f.data.insert(f.data.end(),buf,buf+rd);
+            batch.push_back(f);
+            continue;
+        }
+        dig d(argv[i]);
+        for(dig::const_iterator it = d.begin();it!=d.end() && ret==0;++it){
+            client_file f;
+            f.path = *it;
+            batch.push_back(f);
+            if(batch.size()==CLIENT_BATCH){
+                ret = client_batch(fd,names,batch);
+                batch.clear();
+            }
+        }
+    }
+    if(ret==0 && batch.size()>0) ret = client_batch(fd,names,batch);
+    close(fd);
+    return ret;
+}
+
+void usage(void) __attribute__((noreturn));
+void usage()
+{
+    fprintf(stderr,"usage: sceadand [options] -s <socket>              - classify for clients on socket\n");
+    fprintf(stderr,"       sceadand [options] -c <socket> target ...   - classify target through the daemon\n");
+    fprintf(stderr,"daemon options:\n");
+    fprintf(stderr,"  -m <modelfile>  - use modelfile instead of build-in model\n");
+    fprintf(stderr,"  -f <feature_mask_read_file> - feature mask file name for input\n");
+    fprintf(stderr,"  -n M            - ngram mode (0=disjoint, 1=overlapping, 2=even/odd)\n");
+    fprintf(stderr,"  -w N            - worker threads; each serves one connection at a time\n");
+    fprintf(stderr,"client options:\n");
+    fprintf(stderr,"  -b <size>       - classify blocks of size bytes instead of whole files\n");
+    fprintf(stderr,"  -x              - omit file headers (the first block)\n");
+    fprintf(stderr,"  -m <modelfile>  - take type names from this model or bundle\n");
+    fprintf(stderr,"general:\n");
+    fprintf(stderr,"  -C classfile    - Specify a file of user-defined class types (one type per line)\n");
+    exit(1);
+}
+
+int main(int argc,char **argv)
+{
+    const char *opt_model = 0;
+    const char *opt_class_file = 0;
+    const char *opt_mask = 0;
+    const char *opt_server = 0;
+    const char *opt_client = 0;
+    int opt_ngram_mode = -1;
+    int workers = std::thread::hardware_concurrency();
+    int ch;
+    while((ch = getopt(argc,argv,"b:c:C:f:m:n:s:w:xh")) != -1){
+        switch(ch){
+        case 'b': opt_client_blocks = 1; opt_client_block_size = atoi(optarg); break;
+        case 'c': opt_client = optarg; break;
+        case 'C': opt_class_file = optarg; break;
+        case 'f': opt_mask = optarg; break;
+        case 'm': opt_model = optarg; break;
+        case 'n': opt_ngram_mode = atoi(optarg); break;
+        case 's': opt_server = optarg; break;
+        case 'w': workers = atoi(optarg); break;
+        case 'x': opt_client_omit = 1; break;
+        default: usage();
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if((opt_server==0)==(opt_client==0) || opt_client_block_size<1) usage();
+    if(workers<1) workers = 1;
+
+    if(opt_client){
+        if(argc<1) usage();
+        sceadan *names = sceadan_open(opt_model,opt_class_file,0);
+        if(names==0){
+            fprintf(stderr,"sceadan_open failed.\n");
+            exit(1);
+        }
+        int ret = run_client(opt_client,names,argc,argv);
+        sceadan_close(names);
+        exit(ret<0 || client_failures>0 ? 1 : 0);
+    }
+
+    if(argc>0) usage();
+    sceadan *sc = sceadan_open(opt_model,opt_class_file,opt_mask);
+    if(sc==0){
+        fprintf(stderr,"sceadan_open failed.\n");
+        exit(1);
+    }
+    if(opt_ngram_mode>=0) sceadan_set_ngram_mode(sc,opt_ngram_mode);
+    s = sc;
+    exit(run_server(opt_server,workers)<0 ? 1 : 0);
+}
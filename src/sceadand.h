@@ -0,0 +1,64 @@
+#ifndef SCEADAND_H
+#define SCEADAND_H
+
+#include <stdint.h>
+
+/*
+ * Wire format of sceadand, the resident classifier.
+ *
+ * A client sends a request: a sceadand_request header followed by
+ * count items, each a sceadand_item followed by size bytes. A
+ * SCEADAND_BUFFER item carries the data to classify; a SCEADAND_RANGE
+ * item carries the path of a file the daemon opens and reads from
+ * offset for length bytes. The daemon answers with a sceadand_response
+ * header followed by count sceadan_result records, in the order of the
+ * items and of the blocks within each item. Requests and responses
+ * alternate on a connection until the client closes it.
+ *
+ * Integers are in host byte order, since the socket is local.
+ */
+
+#define SCEADAND_MAGIC     0x4e444353   /* "SCDN" */
+#define SCEADAND_VERSION   1
+#define SCEADAND_MAX_ITEMS 65536        /* per request */
+#define SCEADAND_MAX_SIZE  (1<<30)      /* bytes following one item */
+
+enum {
+    SCEADAND_BUFFER = 1,
+    SCEADAND_RANGE  = 2
+};
+
+#define SCEADAND_FULL_BLOCKS 0x0001     /* do not report a final partial block */
+#define SCEADAND_TO_END      UINT64_MAX /* length of a range that runs to the end of the file */
+
+struct sceadand_request {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;                     /* items that follow */
+    uint32_t reserved;
+};
+
+struct sceadand_item {
+    uint16_t kind;                      /* SCEADAND_BUFFER or SCEADAND_RANGE */
+    uint16_t flags;
+    uint32_t block_size;                /* 0 classifies the item as a whole */
+    uint64_t offset;                    /* of a range; for a buffer, reported as the offset of its first byte */
+    uint64_t length;                    /* of a range */
+    uint64_t size;                      /* bytes that follow: the data or the path */
+};
+
+struct sceadand_response {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;                     /* results that follow */
+    int32_t  status;                    /* 0, or an errno for a malformed request */
+};
+
+struct sceadand_result {
+    uint64_t offset;                    /* of the block; in the file for a range */
+    uint32_t item;                      /* index of the item in the request */
+    int32_t  type;                      /* -1 and score is the errno if the item failed */
+    double   score;                     /* decision margin */
+};
+
+#endif
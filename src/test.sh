@@ -23,6 +23,31 @@ doline() {
 echo Good data here:
 ./sceadan_app $srcdir/../data_test/good   | doline
 
+# Blocks classified on worker threads must come out as on one thread
+./sceadan_app -b 512 $srcdir/../data_test/good > blocks.out
+./sceadan_app -b 512 -w 4 $srcdir/../data_test/good > blocks_w.out
+if [ ! -s blocks.out ] || ! cmp -s blocks.out blocks_w.out; then
+  echo -b 512 -w 4 differs from -b 512:
+  diff blocks.out blocks_w.out
+  bads=yes
+else
+  echo good: -b 512 -w 4
+fi
+rm -f blocks.out blocks_w.out
+
+# A bundle added with -M keeps its own ngram mode when -n sets the primary's
+./sceadan_app -n 0 -B mode0.bundle
+./sceadan_app -b 512 -m mode0.bundle $srcdir/../data_test/good | awk '{print $1,$2,$4}' > bundle.out
+./sceadan_app -b 512 -n 1 -M mode0.bundle $srcdir/../data_test/good | awk '{print $1,$3,$5}' > bundle_n.out
+if [ ! -s bundle.out ] || ! cmp -s bundle.out bundle_n.out; then
+  echo -M mode0.bundle -n 1 differs from -m mode0.bundle:
+  diff bundle.out bundle_n.out
+  bads=yes
+else
+  echo good: -M mode0.bundle -n 1
+fi
+rm -f mode0.bundle bundle.out bundle_n.out
+
 if [ $bads != "no" ]; then
   exit 1;
 fi  
@@ -0,0 +1,55 @@
+#!/bin/sh
+
+if [ x$srcdir = "x" ]; then
+  srcdir=.
+fi
+
+# The model that configure found and linked in; name it so that the
+# daemon, the client and sceadan_app all use the same one
+model=sceadan_model_precompiled.bin
+if [ ! -f $model ]; then
+  echo $model not found
+  exit 1
+fi
+
+sock=/tmp/sceadand.$$
+./sceadand -m $model -s $sock &
+pid=$!
+trap "kill $pid 2>/dev/null" 0
+
+# Wait for the daemon to listen
+tries=0
+while [ ! -S $sock ]; do
+  tries=`expr $tries + 1`
+  if [ $tries -gt 50 ]; then
+    echo sceadand did not start
+    exit 1
+  fi
+  sleep 0.1
+done
+
+bads=no
+
+# The daemon must print what sceadan_app prints
+for opts in "" "-b 512" "-b 4096 -x"; do
+  if ! ./sceadan_app -m $model $opts $srcdir/../data_test/good > app.out || [ ! -s app.out ]; then
+    echo sceadan_app $opts failed
+    bads=yes
+  elif ! ./sceadand -m $model $opts -c $sock $srcdir/../data_test/good > daemon.out; then
+    echo sceadand $opts -c failed
+    bads=yes
+  elif cmp -s app.out daemon.out; then
+    echo good: sceadand $opts
+  else
+    echo sceadand $opts differs from sceadan_app:
+    diff app.out daemon.out
+    bads=yes
+  fi
+done
+rm -f app.out daemon.out
+
+if [ $bads != "no" ]; then
+  exit 1;
+fi
+
+exit 0
@@ -57,15 +57,30 @@ def hms_time(label,t):
     t = int(t * 100)/100
     return "{}: {} ({} seconds)".format(label,str(datetime.timedelta(seconds=t)),t)
 
+sceadan_types_cache = None
+def sceadan_types():
+    """Return {name:number} for every type, listed by one run of sceadan_app -T -"""
+    global sceadan_types_cache
+    if sceadan_types_cache is None:
+        out = Popen([args.exe,'-C',types_filename(),'-T','-'],stdout=PIPE).communicate()[0]
+        sceadan_types_cache = {}
+        for line in out.decode('utf-8').splitlines():
+            (num,name) = line.split('\t',1)
+            sceadan_types_cache[name] = int(num)
+    return sceadan_types_cache
+
 def sceadan_type_for_name(name):
     try:
-        int(Popen([args.exe,'-C',types_filename(),'-T',name],stdout=PIPE).communicate()[0])
-    except ValueError as e:
+        return sceadan_types()[name]
+    except KeyError as e:
         print("Invalid type name: {}".format(name))
         exit(1)
 
 def sceadan_name_for_type(t):
-    return Popen([args.exe,'-C',types_filename(),'-T',str(t)],stdout=PIPE).communicate()[0]
+    for (name,num) in sceadan_types().items():
+        if num==int(t):
+            return name
+    return None
 
 
 ################################################################